@@ -3,7 +3,37 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <sstream>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <atomic>
+#include <cstdio>
+#include <algorithm>
+#include <memory>
+#include <functional>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//Platform sockets (netplay)
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET NetSocket;
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+typedef int NetSocket;
+#define INVALID_SOCKET (-1)
+#endif
 
 //Third Party
 #include <glad/glad.h>
@@ -24,9 +54,14 @@ int gScreenWidth = 1000;
 int gScreenHeight = 1000;
 SDL_Window*		gGraphicsApplicationWindow = nullptr;
 SDL_GLContext	gOpenGLContext = nullptr;
+SDL_Window*		gLoaderWindow = nullptr;  //Hidden, only there so the loader context has its own drawable
+SDL_GLContext	gLoaderContext = nullptr; //Shares objects with gOpenGLContext, used by the asset loader thread
+const char*		gWindowTitle = "Game Window";
 
 bool gQuit = false; //If true, quit
 
+Uint64 gStartupCounter = 0; //Performance counter when main() started
+
 
 //VAO (stores attributes)
 GLuint gVertexArrayObject = 0;
@@ -37,9 +72,73 @@ GLuint gVertexBufferObject = 0;
 //Index Buffer Object (IBO)
 GLuint gIndexBufferObject = 0;
 
+//Second VBO with a (u, v, atlas layer) texture coordinate per vertex
+GLuint gTexCoordBufferObject = 0;
+
+//Texture array holding the sprite atlas pages
+GLuint gSpriteAtlasTexture = 0;
+
 //Program object for shaders
 GLuint gGraphicsPipelineShaderProgram = 0;
 
+//Offscreen target the scene is drawn into before being scaled to the window
+GLuint gSceneFramebuffer = 0;
+GLuint gSceneColorRenderbuffer = 0;
+
+//Dynamic Resolution Variables
+float gFrameTimeBudgetMs = 16.6f; //Target time for one frame on the GPU
+const float gMinResolutionScale = 0.25f;
+const float gMaxResolutionScale = 1.0f;
+const float gResolutionScaleStep = 0.05f;
+const float gScaleUpHeadroom = 0.75f; //Only scale up when this far under budget
+const int gScaleDownFrames = 3;   //Frames over budget before scaling down
+const int gScaleUpFrames = 30;    //Frames under budget before scaling up
+int gFramesOverBudget = 0;
+int gFramesUnderBudget = 0;
+Uint32 gLastStatsTitleTime = 0;
+
+//Timer queries are read a few frames late so reading them never stalls
+const int gFrameTimeQueryCount = 4;
+GLuint gFrameTimeQueries[gFrameTimeQueryCount] = {};
+bool gFrameTimeQueryPending[gFrameTimeQueryCount] = {};
+int gFrameTimeQueryIndex = 0;
+bool gFrameTimeQueryActive = false; //False when this frame found its slot still in flight
+
+struct RenderStats {
+	float resolutionScale = 1.0f;
+	float gpuFrameTimeMs = 0.0f;
+	float cpuFrameTimeMs = 0.0f;
+	int renderWidth = 0;
+	int renderHeight = 0;
+};
+
+RenderStats gRenderStats;
+
+//Particle Variables
+const int gParticleCapacity = 65536;
+const int gParticleFloatCount = 6; //position xy, velocity xy, age, lifetime
+const int gMaxParticleBursts = 16; //Must match MAX_BURSTS in particle_update.glsl
+const float gParticleGravity = -2.0f; //Units per second squared
+const float gParticleFloor = -0.8f;   //Top of the floor quad
+const float gParticlePointSize = 3.0f; //Pixels at full resolution
+GLuint gParticleUpdateProgram = 0;
+GLuint gParticleRenderProgram = 0;
+GLuint gParticleBuffers[2] = {};
+GLuint gParticleVertexArrays[2] = {};
+int gParticleSource = 0; //Buffer holding the current particles, the other one gets written
+int gParticleCursor = 0; //Next slot a burst will claim
+Uint32 gParticleSeed = 1;
+float gParticleTime = 0.0f;
+float gParticlesAliveUntil = 0.0f; //Every particle is dead after this time
+
+struct ParticleUniforms {
+	GLint deltaTime, gravity, floor, seed, particleCount;
+	GLint burstCount, burstRange, burstShape, burstMotion;
+	GLint pointSize;
+};
+
+ParticleUniforms gParticleUniforms;
+
 //Movement variables for Quads
 float g_uOffset = 0.0f;
 float g_uOffsetQuad1 = -0.7f;
@@ -55,7 +154,29 @@ float g_vOffsetQuad7 = 0.0f;
 float gGravity = -0.00009999f;
 bool isCollide = false;
 bool isDivide = false;
-bool canJump = false;
+bool canJump = false;  //Left player (quad6)
+bool canJump2 = false; //Right player (quad7)
+bool atWallQuad6 = false; //Halves resting against a wall or the divider, so a hit only fires once
+bool atWallQuad7 = false;
+float wallStopQuad6 = 0.0f;
+float wallStopQuad7 = 0.0f;
+
+//Set when the CPU copy of the vertex data changed and needs to go to the GPU
+bool gVertexDataDirty = false;
+
+//7 quads, 4 vertices each, 6 floats per vertex
+const int gVertexFloatCount = 7 * 4 * 6;
+const int gQuadVertexCount = gVertexFloatCount / 6;
+
+//Sprite Variables
+const int gMaxSprites = 1024;     //Sprites per frame, stored after the world quads
+const int gAtlasPageSize = 1024;  //Width and height of one atlas page
+const int gAtlasPadding = 1;      //Gap between packed sprites
+int gSpriteDrawCount = 0;         //Sprites uploaded this frame
+
+//Texture coordinates for the world quads, layer -1 means untextured
+GLfloat gQuadTexCoords[gQuadVertexCount * 3];
+bool gTexCoordsDirty = false;
 
 //Collision Struct
 struct Collider {
@@ -77,22 +198,297 @@ Collider quad6Collider;
 Collider quad7Collider;
 
 
+//Input bits, one byte per player per simulation tick
+const Uint8 INPUT_LEFT = 1 << 0;
+const Uint8 INPUT_RIGHT = 1 << 1;
+const Uint8 INPUT_UP = 1 << 2;
+
+//Everything the simulation reads or writes, so a tick can be saved and rewound.
+//Plain data on purpose: saving is a memcpy.
+struct GameState {
+	float uOffsetQuad1, vOffsetQuad1;
+	float uOffsetQuad5, vOffsetQuad5;
+	float uOffsetQuad6, vOffsetQuad6;
+	float uOffsetQuad7, vOffsetQuad7;
+	bool isCollide, isDivide, canJump, canJump2;
+	bool atWallQuad6, atWallQuad7;
+	float wallStopQuad6, wallStopQuad7;
+	Collider quad1Collider, quad5Collider, quad6Collider, quad7Collider;
+	GLfloat vertexData[gVertexFloatCount];
+};
+
+//True while rollback is re-running ticks that were already simulated once
+bool gRollbackResimulating = false;
+
+//Tick SimulateTick() is running, events are tagged with it
+Uint32 gSimulationTick = 0;
+
+
+//Heap Allocation Counter
+//Counts every call to the global operator new so we can check that a
+//steady-state frame never touches the heap.
+std::atomic<Uint64> gHeapAllocationCount{ 0 };
+Uint64 gSteadyStateHeapAllocations = 0;
+const Uint64 gWarmupFrames = 60; //Frames allowed to allocate while things settle
+
+void* operator new(std::size_t size) {
+	gHeapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+
+	void* memory = std::malloc(size != 0 ? size : 1);
+	if (memory == nullptr) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+	std::free(memory);
+}
+
+
+//Frame Arena
+//Linear allocator for transient data that only lives for one MainLoop iteration.
+//Allocating is a pointer bump and nothing is freed individually, the whole
+//arena is reset at the top of each frame.
+struct FrameArena {
+	unsigned char* buffer = nullptr;
+	size_t capacity = 0;
+	size_t offset = 0;
+	size_t peak = 0;           //Furthest offset reached this frame, deallocate() can move offset back
+	size_t lastFrameBytes = 0; //Bytes used by the previous frame
+	size_t highWaterMark = 0;  //Most bytes used by any single frame
+};
+
+const size_t gFrameArenaSize = 1024 * 1024;
+FrameArena gFrameArena;
+
+void FrameArenaCreate(FrameArena& arena, size_t capacity) {
+	arena.buffer = static_cast<unsigned char*>(std::malloc(capacity));
+	if (arena.buffer == nullptr) {
+		std::cout << "Frame arena could not be allocated" << std::endl;
+		exit(1);
+	}
+	arena.capacity = capacity;
+	arena.offset = 0;
+}
+
+void FrameArenaDestroy(FrameArena& arena) {
+	std::free(arena.buffer);
+	arena = FrameArena{};
+}
+
+//Returns nullptr when the arena is out of space
+void* FrameArenaAllocate(FrameArena& arena, size_t size, size_t alignment) {
+	size_t start = (arena.offset + alignment - 1) & ~(alignment - 1);
+	if (start + size > arena.capacity) {
+		return nullptr;
+	}
+	arena.offset = start + size;
+	arena.peak = std::max(arena.peak, arena.offset);
+	return arena.buffer + start;
+}
+
+void FrameArenaReset(FrameArena& arena) {
+	//Use the peak, containers destroyed at the end of the frame have already rolled offset back
+	arena.lastFrameBytes = arena.peak;
+	if (arena.peak > arena.highWaterMark) {
+		arena.highWaterMark = arena.peak;
+	}
+
+#ifndef NDEBUG
+	//Poison everything last frame touched so anything holding on to it shows up quickly
+	std::memset(arena.buffer, 0xCD, arena.peak);
+#endif
+
+	arena.offset = 0;
+	arena.peak = 0;
+}
+
+//STL allocator adapter so containers can live in the frame arena,
+//e.g. FrameVector<Collider> contacts{ FrameAllocator<Collider>(gFrameArena) };
+template <typename T>
+struct FrameAllocator {
+	typedef T value_type;
+
+	FrameArena* arena;
+
+	FrameAllocator(FrameArena& frameArena) noexcept : arena(&frameArena) {}
+
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U>& other) noexcept : arena(other.arena) {}
+
+	T* allocate(size_t count) {
+		void* memory = FrameArenaAllocate(*arena, count * sizeof(T), alignof(T));
+		if (memory == nullptr) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(memory);
+	}
+
+	void deallocate(T* memory, size_t count) noexcept {
+		//Only the most recent allocation can be given back (e.g. a vector growing)
+		unsigned char* end = reinterpret_cast<unsigned char*>(memory) + count * sizeof(T);
+		if (end == arena->buffer + arena->offset) {
+			arena->offset = reinterpret_cast<unsigned char*>(memory) - arena->buffer;
+		}
+	}
+};
+
+template <typename T, typename U>
+bool operator==(const FrameAllocator<T>& a, const FrameAllocator<U>& b) noexcept {
+	return a.arena == b.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const FrameAllocator<T>& a, const FrameAllocator<U>& b) noexcept {
+	return a.arena != b.arena;
+}
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+
+//Quad 1 vertices are +-0.09 around its offset
+const float gCharacterHalfSize = 0.09f;
+
+//Things that happened during a tick that effects care about
+enum GameEventType {
+	GAME_EVENT_SPLIT,
+	GAME_EVENT_LAND,
+	GAME_EVENT_WALL_HIT
+};
+
+struct GameEvent {
+	GameEventType type;
+	glm::vec2 position;
+	Uint32 tick;
+	int source; //Quad it happened to: 1, 6 or 7
+};
+
+//This frame's events, lives in the frame arena and is set up by MainLoop
+FrameVector<GameEvent>* gFrameEvents = nullptr;
+
+//Rollback re-runs ticks, so an event can be produced more than once for the same tick.
+//Events already handed out are remembered here so only new ones are emitted, which
+//keeps events that only happen in the corrected timeline (e.g. a split caused by
+//the remote's real input) while dropping repeats.
+struct EmittedGameEvent {
+	Uint32 tick;
+	GameEventType type;
+	int source;
+};
+
+const int gEmittedGameEventCount = 64; //Events are sparse, this covers the whole rollback window
+EmittedGameEvent gEmittedGameEvents[gEmittedGameEventCount];
+int gEmittedGameEventNext = 0;
+bool gDedupeGameEvents = false; //Set while netplay is rolling back
+
+//A packed image: where it is in the atlas
+struct SpriteFrame {
+	std::string name;
+	int layer;
+	float u0, v0, u1, v1;
+};
+
+//One sprite to draw this frame
+struct SpriteDraw {
+	int frame = -1;
+	glm::vec2 position; //Bottom left corner
+	glm::vec2 size;
+	int depth = 0;      //Lower draws first
+	int order = 0;      //Submission order, keeps the sort stable
+};
+
+//Decoded image waiting to be packed
+struct SpriteImage {
+	std::string name;
+	int width = 0;
+	int height = 0;
+	std::vector<unsigned char> pixels; //RGBA, bottom row first
+};
+
+//Worker-side results of building the atlas, handed on to the upload and finish steps
+struct SpriteAtlasBuild {
+	std::vector<SpriteImage> images;
+	std::vector<std::vector<unsigned char>> pages;
+	std::vector<SpriteFrame> frames;
+	std::vector<SpriteDraw> placements;
+	std::vector<std::string> placementNames;
+};
+
+std::vector<SpriteFrame> gSpriteFrames;
+std::vector<SpriteDraw> gSpriteDecorations; //Placed by sprites.txt, drawn every frame
+
+//This frame's sprites, lives in the frame arena and is set up by MainLoop
+FrameVector<SpriteDraw>* gFrameSprites = nullptr;
+
+void RecordGameEvent(GameEventType type, int source, float x, float y) {
+	if (gFrameEvents == nullptr) {
+		return;
+	}
+
+	if (gDedupeGameEvents) {
+		for (const EmittedGameEvent& emitted : gEmittedGameEvents) {
+			if (emitted.tick == gSimulationTick && emitted.type == type && emitted.source == source) {
+				return;
+			}
+		}
+		gEmittedGameEvents[gEmittedGameEventNext] = EmittedGameEvent{ gSimulationTick, type, source };
+		gEmittedGameEventNext = (gEmittedGameEventNext + 1) % gEmittedGameEventCount;
+	}
+
+	gFrameEvents->push_back(GameEvent{ type, glm::vec2(x, y), gSimulationTick, source });
+}
+
+//The halves are clamped every tick they push against something, only the first contact is a hit.
+//Contact ends once the half has moved away from where it was stopped.
+void TrackHalfWallContact(int source, bool clamped, float offset, float hitX, float hitY, bool& atWall, float& wallStop) {
+	if (clamped && !atWall) {
+		RecordGameEvent(GAME_EVENT_WALL_HIT, source, hitX, hitY);
+		atWall = true;
+		wallStop = offset;
+	}
+	else if (atWall && std::abs(offset - wallStop) > 0.01f) {
+		atWall = false;
+	}
+}
 
 
-std::string LoadShaderAsString(const std::string& filename) {
+std::string LoadFileAsString(const std::string& filename) {
 
-	//shader program loaded as single string. Dont want to compile everytime
+	//whole file loaded as a single string (shader source or binary data)
 	std::string result = ""; 
 
-	std::string line = "";
-	std::ifstream myFile(filename.c_str());
+	std::ifstream myFile(filename.c_str(), std::ios::in | std::ios::binary);
 
 	if (myFile.is_open()) {
-		while (std::getline(myFile, line)) {
-			result += line + '\n';
+		myFile.seekg(0, std::ios::end);
+		std::streamoff size = myFile.tellg();
+		myFile.seekg(0, std::ios::beg);
+
+		//A directory opens fine but reports a bogus size, peeking is what fails on it
+		myFile.peek();
+		if (size < 0 || myFile.bad()) {
+			std::cout << "Could not read " << filename << std::endl;
+			return result;
+		}
+		myFile.clear(); //An empty file leaves eof set after the peek
+
+		result.resize(static_cast<size_t>(size));
+		myFile.read(&result[0], size);
+		if (myFile.gcount() != size) {
+			std::cout << "Could not read " << filename << std::endl;
+			result.clear();
 		}
 		myFile.close();
 	}
+	else {
+		std::cout << "Could not open " << filename << std::endl;
+	}
 
 	return result;
 }
@@ -131,12 +527,268 @@ GLuint CreateShaderProgram(const std::string& vertexshadersource, const std::str
 	return programObject;
 }
 
+//Asset Loading
+//Assets load in three stages so the render thread never waits on disk or the driver:
+// 1. a worker thread reads the files and does any CPU-side decoding
+// 2. the loader thread, whose GL context shares objects with the main one,
+//    creates and uploads GL objects, then drops a fence
+// 3. the render thread picks the load up once its fence has signalled and does
+//    whatever can't be shared between contexts (VAOs, FBOs)
+//Loads can be queued at any time, e.g. for a level switch.
+struct AssetLoad {
+	std::vector<std::string> files;    //Read on a worker thread
+	std::vector<std::string> contents; //One entry per file
+	GLuint objects[8] = {};            //GL objects made by upload, handed to finish
+	GLsync fence = nullptr;
+
+	std::function<void(AssetLoad&)> decode; //Worker thread, optional
+	std::function<void(AssetLoad&)> upload; //Loader thread
+	std::function<void(AssetLoad&)> finish; //Render thread
+};
+
+struct AssetLoader {
+	SDL_Window* window = nullptr;
+	SDL_GLContext context = nullptr; //Shared context, null means uploads happen on the render thread
+	std::atomic<bool> contextFailed{ false }; //Loader thread couldn't make the context current
+	std::vector<std::thread> workers;
+	std::thread uploadThread;
+
+	std::mutex mutex;
+	std::condition_variable readReady;
+	std::condition_variable uploadReady;
+	std::deque<std::unique_ptr<AssetLoad>> readQueue;
+	std::deque<std::unique_ptr<AssetLoad>> uploadQueue;
+	std::deque<std::unique_ptr<AssetLoad>> finishQueue;
+	bool stopping = false;
+
+	std::atomic<int> pending{ 0 };
+};
+
+const int gAssetWorkerCount = 2;
+AssetLoader gAssetLoader;
+
+void AssetWorkerThread() {
+	while (true) {
+		std::unique_ptr<AssetLoad> load;
+		{
+			std::unique_lock<std::mutex> lock(gAssetLoader.mutex);
+			gAssetLoader.readReady.wait(lock, [] { return gAssetLoader.stopping || !gAssetLoader.readQueue.empty(); });
+			if (gAssetLoader.stopping) {
+				return;
+			}
+			load = std::move(gAssetLoader.readQueue.front());
+			gAssetLoader.readQueue.pop_front();
+		}
+
+		for (const std::string& file : load->files) {
+			load->contents.push_back(LoadFileAsString(file));
+		}
+		if (load->decode) {
+			load->decode(*load);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(gAssetLoader.mutex);
+			gAssetLoader.uploadQueue.push_back(std::move(load));
+		}
+		gAssetLoader.uploadReady.notify_one();
+	}
+}
+
+void AssetUploadThread() {
+	//The render thread sees the flag, joins us and takes over the uploads
+	if (SDL_GL_MakeCurrent(gAssetLoader.window, gAssetLoader.context) != 0) {
+		std::cout << "Loader thread could not make its OpenGL context current: " << SDL_GetError() << std::endl;
+		gAssetLoader.contextFailed = true;
+		return;
+	}
+
+	while (true) {
+		std::unique_ptr<AssetLoad> load;
+		{
+			std::unique_lock<std::mutex> lock(gAssetLoader.mutex);
+			gAssetLoader.uploadReady.wait(lock, [] { return gAssetLoader.stopping || !gAssetLoader.uploadQueue.empty(); });
+			if (gAssetLoader.stopping) {
+				break;
+			}
+			load = std::move(gAssetLoader.uploadQueue.front());
+			gAssetLoader.uploadQueue.pop_front();
+		}
+
+		load->upload(*load);
+
+		//Flush so the fence actually reaches the GPU and the render thread can see it signal
+		load->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		if (load->fence != nullptr) {
+			glFlush();
+		}
+		else {
+			//No fence to wait on, so finish here and hand it over as already complete
+			std::cout << "Asset load fence could not be created, waiting on the loader thread" << std::endl;
+			glFinish();
+		}
+
+		std::lock_guard<std::mutex> lock(gAssetLoader.mutex);
+		gAssetLoader.finishQueue.push_back(std::move(load));
+	}
+
+	SDL_GL_MakeCurrent(gAssetLoader.window, nullptr);
+}
+
+void StopAssetLoader() {
+	{
+		std::lock_guard<std::mutex> lock(gAssetLoader.mutex);
+		gAssetLoader.stopping = true;
+	}
+	gAssetLoader.readReady.notify_all();
+	gAssetLoader.uploadReady.notify_all();
+
+	for (std::thread& worker : gAssetLoader.workers) {
+		worker.join();
+	}
+	gAssetLoader.workers.clear();
+
+	if (gAssetLoader.uploadThread.joinable()) {
+		gAssetLoader.uploadThread.join();
+	}
+	for (std::unique_ptr<AssetLoad>& load : gAssetLoader.finishQueue) {
+		if (load->fence != nullptr) {
+			glDeleteSync(load->fence);
+		}
+	}
+	gAssetLoader.finishQueue.clear();
+
+	if (gAssetLoader.context != nullptr) {
+		SDL_GL_DeleteContext(gAssetLoader.context);
+		gAssetLoader.context = nullptr;
+	}
+}
+
+void StartAssetLoader(SDL_Window* loaderWindow, SDL_GLContext loaderContext) {
+	gAssetLoader.window = loaderWindow;
+	gAssetLoader.context = loaderContext;
+
+	//Every exit(1) from here on would otherwise destroy joinable threads and abort,
+	//so stop the loader first. Runs again harmlessly after CleanUp().
+	std::atexit(StopAssetLoader);
+
+	for (int i = 0; i < gAssetWorkerCount; i++) {
+		gAssetLoader.workers.push_back(std::thread(AssetWorkerThread));
+	}
+	if (gAssetLoader.context != nullptr) {
+		gAssetLoader.uploadThread = std::thread(AssetUploadThread);
+	}
+	else {
+		std::cout << "No shared OpenGL context, uploading assets on the render thread" << std::endl;
+	}
+}
+
+void QueueAssetLoad(std::unique_ptr<AssetLoad> load) {
+	gAssetLoader.pending++;
+	{
+		std::lock_guard<std::mutex> lock(gAssetLoader.mutex);
+		gAssetLoader.readQueue.push_back(std::move(load));
+	}
+	gAssetLoader.readReady.notify_one();
+}
+
+bool AssetLoadsPending() {
+	return gAssetLoader.pending.load() != 0;
+}
+
+//Called by the render thread once per frame, never blocks
+void PumpAssetLoads() {
+	//Loader thread gave up before uploading anything, fall back to uploading here
+	if (gAssetLoader.context != nullptr && gAssetLoader.contextFailed) {
+		gAssetLoader.uploadThread.join();
+		SDL_GL_DeleteContext(gAssetLoader.context);
+		gAssetLoader.context = nullptr;
+		std::cout << "Uploading assets on the render thread instead" << std::endl;
+	}
+
+	//Without a shared context the upload has to happen here, one load per frame
+	if (gAssetLoader.context == nullptr) {
+		std::unique_ptr<AssetLoad> load;
+		{
+			std::lock_guard<std::mutex> lock(gAssetLoader.mutex);
+			if (!gAssetLoader.uploadQueue.empty()) {
+				load = std::move(gAssetLoader.uploadQueue.front());
+				gAssetLoader.uploadQueue.pop_front();
+			}
+		}
+		if (load) {
+			load->upload(*load);
+			load->finish(*load);
+			gAssetLoader.pending--;
+		}
+		return;
+	}
+
+	while (true) {
+		std::unique_ptr<AssetLoad> load;
+		GLenum status = GL_ALREADY_SIGNALED;
+		{
+			std::lock_guard<std::mutex> lock(gAssetLoader.mutex);
+			if (gAssetLoader.finishQueue.empty()) {
+				break;
+			}
+
+			//Fences from the loader signal in order, so only the oldest needs checking
+			GLsync fence = gAssetLoader.finishQueue.front()->fence;
+			if (fence != nullptr) {
+				status = glClientWaitSync(fence, 0, 0);
+			}
+			if (status == GL_TIMEOUT_EXPIRED) {
+				break;
+			}
+			if (status != GL_WAIT_FAILED) {
+				load = std::move(gAssetLoader.finishQueue.front());
+				gAssetLoader.finishQueue.pop_front();
+			}
+		}
+
+		//Outside the lock, exiting stops the loader and that takes the lock too
+		if (status == GL_WAIT_FAILED) {
+			std::cout << "Waiting on an asset load fence failed: " << glGetError() << std::endl;
+			exit(1);
+		}
+
+		if (load->fence != nullptr) {
+			glDeleteSync(load->fence);
+		}
+		load->finish(*load);
+		gAssetLoader.pending--;
+	}
+}
+
+//Vertex-only program whose outputs are captured with transform feedback
+GLuint CreateTransformFeedbackProgram(const std::string& vertexshadersource, const char* const* varyings, GLsizei varyingCount) {
+	GLuint programObject = glCreateProgram();
+
+	GLuint myVertexShader = CompileShader(GL_VERTEX_SHADER, vertexshadersource);
+	glAttachShader(programObject, myVertexShader);
+
+	//Has to be set before linking
+	glTransformFeedbackVaryings(programObject, varyingCount, varyings, GL_INTERLEAVED_ATTRIBS);
+	glLinkProgram(programObject);
+
+	return programObject;
+}
+
 void CreateGraphicsPipeline() {
 
-	std::string vertexShaderSource = LoadShaderAsString("./vert.glsl");
-	std::string fragmentShaderSource = LoadShaderAsString("./frag.glsl");
+	//Files are read on a worker, compiled and linked on the loader thread
+	std::unique_ptr<AssetLoad> load(new AssetLoad());
+	load->files = { "./vert.glsl", "./frag.glsl" };
+
+	load->upload = [](AssetLoad& self) {
+		self.objects[0] = CreateShaderProgram(self.contents[0], self.contents[1]);
+	};
+	load->finish = [](AssetLoad& self) {
+		gGraphicsPipelineShaderProgram = self.objects[0];
+	};
 
-	gGraphicsPipelineShaderProgram = CreateShaderProgram(vertexShaderSource, fragmentShaderSource);
+	QueueAssetLoad(std::move(load));
 
 }
 
@@ -255,72 +907,135 @@ void VertexSpecification(std::vector<GLfloat> &vertexData) {
 			 		
 	};
 
-	//Start setting things up on the GPU
-	glGenVertexArrays(1, &gVertexArrayObject);
-	//select the array
-	glBindVertexArray(gVertexArrayObject);
+	//Rollback snapshots copy this straight into GameState
+	if (vertexData.size() != gVertexFloatCount) {
+		std::cout << "Vertex data does not match gVertexFloatCount" << std::endl;
+		exit(1);
+	}
 
-	//Start generating VBO
-	glGenBuffers(1, &gVertexBufferObject);
-	//select the buffer
-	glBindBuffer(GL_ARRAY_BUFFER, gVertexBufferObject);
-	glBufferData(GL_ARRAY_BUFFER,
-		vertexData.size() * sizeof(GLfloat),
-		vertexData.data(),
-		GL_DYNAMIC_DRAW); //Using dynamic draw because data will change 
-
-
-	const std::vector <GLuint> indexBufferData{ 
-		//Quad 1       Highest Indicie: 27
-		2, 0, 1, 3, 2, 1,
-		//Quad 2
-		4, 5, 6, 6, 5, 7,
-		//Quad 3
-		10, 8, 9, 11, 10, 9,
-		//Quad 4
-		14, 12, 13, 15, 14, 13,
-		//Quad 5
-		18, 16, 17, 19, 18, 17,
-		//Quad 6
-		22, 20, 21, 23, 22, 21,
-		//Quad 7
-		26, 24, 25, 27, 26, 25
-		
+	//Untextured until the sprite atlas says otherwise
+	for (int vertex = 0; vertex < gQuadVertexCount; vertex++) {
+		gQuadTexCoords[vertex * 3 + 0] = 0.0f;
+		gQuadTexCoords[vertex * 3 + 1] = 0.0f;
+		gQuadTexCoords[vertex * 3 + 2] = -1.0f;
+	}
+
+	//The GPU side goes through the asset loader so the first frame doesn't wait on it.
+	//Upload a copy, the simulation is free to change vertexData in the meantime.
+	std::unique_ptr<AssetLoad> load(new AssetLoad());
+	std::vector<GLfloat> initialVertexData = vertexData;
+	std::vector<GLfloat> initialTexCoords(gQuadTexCoords, gQuadTexCoords + gQuadVertexCount * 3);
+
+	load->upload = [initialVertexData, initialTexCoords](AssetLoad& self) {
+		//Room for the world quads followed by this frame's sprites
+		GLsizeiptr spriteVertexCount = gMaxSprites * 4;
+
+		//Start generating VBO
+		glGenBuffers(1, &self.objects[0]);
+		//select the buffer
+		glBindBuffer(GL_ARRAY_BUFFER, self.objects[0]);
+		glBufferData(GL_ARRAY_BUFFER,
+			(initialVertexData.size() + spriteVertexCount * 6) * sizeof(GLfloat),
+			nullptr,
+			GL_DYNAMIC_DRAW); //Using dynamic draw because data will change 
+		glBufferSubData(GL_ARRAY_BUFFER, 0, initialVertexData.size() * sizeof(GLfloat), initialVertexData.data());
+
+		//Texture coordinates live in their own buffer so the layout above stays as it is
+		glGenBuffers(1, &self.objects[2]);
+		glBindBuffer(GL_ARRAY_BUFFER, self.objects[2]);
+		glBufferData(GL_ARRAY_BUFFER,
+			(initialTexCoords.size() + spriteVertexCount * 3) * sizeof(GLfloat),
+			nullptr,
+			GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, initialTexCoords.size() * sizeof(GLfloat), initialTexCoords.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		std::vector <GLuint> indexBufferData{ 
+			//Quad 1       Highest Indicie: 27
+			2, 0, 1, 3, 2, 1,
+			//Quad 2
+			4, 5, 6, 6, 5, 7,
+			//Quad 3
+			10, 8, 9, 11, 10, 9,
+			//Quad 4
+			14, 12, 13, 15, 14, 13,
+			//Quad 5
+			18, 16, 17, 19, 18, 17,
+			//Quad 6
+			22, 20, 21, 23, 22, 21,
+			//Quad 7
+			26, 24, 25, 27, 26, 25
+			
+		};
+
+		//Sprites use the same pattern, four vertices each after the world quads
+		for (GLuint sprite = 0; sprite < static_cast<GLuint>(gMaxSprites); sprite++) {
+			GLuint first = gQuadVertexCount + sprite * 4;
+			GLuint quad[6] = { first + 2, first, first + 1, first + 3, first + 2, first + 1 };
+			indexBufferData.insert(indexBufferData.end(), quad, quad + 6);
+		}
+
+		//Set up the Index Buffer Object (IBO i.e. EBO)
+		//The element binding belongs to a VAO and there is none on this context,
+		//so fill it through the copy target and let finish attach it to the VAO
+		glGenBuffers(1, &self.objects[1]);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, self.objects[1]);
+		//Populate our Index Buffer
+		glBufferData(GL_COPY_WRITE_BUFFER,
+			indexBufferData.size() * sizeof(GLuint),
+			indexBufferData.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 	};
 
-	//Set up the Index Buffer Object (IBO i.e. EBO)
-	glGenBuffers(1, &gIndexBufferObject);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gIndexBufferObject);
-	//Populate our Index Buffer
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-		indexBufferData.size() * sizeof(GLuint),
-		indexBufferData.data(), GL_DYNAMIC_DRAW);
-				
-
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0,
-		3,
-		GL_FLOAT,
-		GL_FALSE,
-		sizeof(GL_FLOAT)*6,
-		(void*)0
-		);
+	//VAOs can't be shared between contexts, so it is built on the render thread
+	load->finish = [](AssetLoad& self) {
+		gVertexBufferObject = self.objects[0];
+		gIndexBufferObject = self.objects[1];
+		gTexCoordBufferObject = self.objects[2];
 
-	
-    //Now link to VAO
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1,
-		3, //R,G,B
-		GL_FLOAT,
-		GL_FALSE,
-		sizeof(GL_FLOAT)*6,
-		(GLvoid*)(sizeof(GL_FLOAT)*3)
-		);
-	 
-  //Clean up
-  glBindVertexArray(0);
-  glDisableVertexAttribArray(0);
-  glDisableVertexAttribArray(1);
+		glGenVertexArrays(1, &gVertexArrayObject);
+		//select the array
+		glBindVertexArray(gVertexArrayObject);
+
+		glBindBuffer(GL_ARRAY_BUFFER, gVertexBufferObject);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gIndexBufferObject);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0,
+			3,
+			GL_FLOAT,
+			GL_FALSE,
+			sizeof(GL_FLOAT)*6,
+			(void*)0
+			);
+
+		
+	    //Now link to VAO
+	    glEnableVertexAttribArray(1);
+	    glVertexAttribPointer(1,
+			3, //R,G,B
+			GL_FLOAT,
+			GL_FALSE,
+			sizeof(GL_FLOAT)*6,
+			(GLvoid*)(sizeof(GL_FLOAT)*3)
+			);
+
+		//Texture coordinates from the second buffer
+		glBindBuffer(GL_ARRAY_BUFFER, gTexCoordBufferObject);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2,
+			3, //U,V,Layer
+			GL_FLOAT,
+			GL_FALSE,
+			sizeof(GL_FLOAT)*3,
+			(GLvoid*)0
+			);
+		 
+	  //Clean up
+	  glBindVertexArray(0);
+	};
+
+	QueueAssetLoad(std::move(load));
 }
 
 
@@ -342,7 +1057,7 @@ void InitializeProgram() {
 	SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
 
 	//Create window
-	gGraphicsApplicationWindow = SDL_CreateWindow("Game Window",
+	gGraphicsApplicationWindow = SDL_CreateWindow(gWindowTitle,
 		4, 4, 
 		gScreenWidth, gScreenHeight,
 	    SDL_WINDOW_OPENGL);
@@ -366,31 +1081,113 @@ void InitializeProgram() {
 		exit(1);
 	}
 
+	//Second context for the asset loader thread, sharing buffers, programs and textures.
+	//It gets its own hidden window, a drawable can't be current in two threads at once.
+	//Creating it makes it current, so switch back to the main one afterwards.
+	gLoaderWindow = SDL_CreateWindow(gWindowTitle, 0, 0, 1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (gLoaderWindow != nullptr) {
+		SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+		gLoaderContext = SDL_GL_CreateContext(gLoaderWindow);
+		SDL_GL_MakeCurrent(gGraphicsApplicationWindow, gOpenGLContext);
+	}
+
+	if (gLoaderContext == nullptr) {
+		std::cout << "Shared OpenGL context not available: " << SDL_GetError() << std::endl;
+	}
+
 	GetOpenGLVersionInfo();
 }
 
-void Input(std::vector<GLfloat> vertexData) {
+//Handles window events and turns the keyboard into input bits
+Uint8 PollInput() {
 	SDL_Event e;
 
-while (SDL_PollEvent(&e) != 0) {
-	if (e.type == SDL_QUIT) {
-		std::cout << "Goodbye!" << std::endl;
-		gQuit = true;
+	while (SDL_PollEvent(&e) != 0) {
+		if (e.type == SDL_QUIT) {
+			std::cout << "Goodbye!" << std::endl;
+			gQuit = true;
+
+		}
+
+	}
+
+	//Retrieve keyboard state
+	const Uint8* state = SDL_GetKeyboardState(NULL);
+	Uint8 input = 0;
 
+	if (state[SDL_SCANCODE_LEFT]) {
+		input |= INPUT_LEFT;
+	}
+	if (state[SDL_SCANCODE_RIGHT]) {
+		input |= INPUT_RIGHT;
+	}
+	if (state[SDL_SCANCODE_UP]) {
+		input |= INPUT_UP;
 	}
 
+	return input;
 }
 
-//Retrieve keyboard state
-const Uint8* state = SDL_GetKeyboardState(NULL);
+void SaveGameState(GameState& gameState, const std::vector<GLfloat>& vertexData) {
+	gameState.uOffsetQuad1 = g_uOffsetQuad1;
+	gameState.vOffsetQuad1 = g_vOffsetQuad1;
+	gameState.uOffsetQuad5 = g_uOffsetQuad5;
+	gameState.vOffsetQuad5 = g_vOffsetQuad5;
+	gameState.uOffsetQuad6 = g_uOffsetQuad6;
+	gameState.vOffsetQuad6 = g_vOffsetQuad6;
+	gameState.uOffsetQuad7 = g_uOffsetQuad7;
+	gameState.vOffsetQuad7 = g_vOffsetQuad7;
+	gameState.isCollide = isCollide;
+	gameState.isDivide = isDivide;
+	gameState.canJump = canJump;
+	gameState.canJump2 = canJump2;
+	gameState.atWallQuad6 = atWallQuad6;
+	gameState.atWallQuad7 = atWallQuad7;
+	gameState.wallStopQuad6 = wallStopQuad6;
+	gameState.wallStopQuad7 = wallStopQuad7;
+	gameState.quad1Collider = quad1Collider;
+	gameState.quad5Collider = quad5Collider;
+	gameState.quad6Collider = quad6Collider;
+	gameState.quad7Collider = quad7Collider;
+	std::memcpy(gameState.vertexData, vertexData.data(), sizeof(gameState.vertexData));
+}
+
+void LoadGameState(const GameState& gameState, std::vector<GLfloat>& vertexData) {
+	g_uOffsetQuad1 = gameState.uOffsetQuad1;
+	g_vOffsetQuad1 = gameState.vOffsetQuad1;
+	g_uOffsetQuad5 = gameState.uOffsetQuad5;
+	g_vOffsetQuad5 = gameState.vOffsetQuad5;
+	g_uOffsetQuad6 = gameState.uOffsetQuad6;
+	g_vOffsetQuad6 = gameState.vOffsetQuad6;
+	g_uOffsetQuad7 = gameState.uOffsetQuad7;
+	g_vOffsetQuad7 = gameState.vOffsetQuad7;
+	isCollide = gameState.isCollide;
+	isDivide = gameState.isDivide;
+	canJump = gameState.canJump;
+	canJump2 = gameState.canJump2;
+	atWallQuad6 = gameState.atWallQuad6;
+	atWallQuad7 = gameState.atWallQuad7;
+	wallStopQuad6 = gameState.wallStopQuad6;
+	wallStopQuad7 = gameState.wallStopQuad7;
+	quad1Collider = gameState.quad1Collider;
+	quad5Collider = gameState.quad5Collider;
+	quad6Collider = gameState.quad6Collider;
+	quad7Collider = gameState.quad7Collider;
+
+	//Only re-upload when the split geometry actually differs
+	if (std::memcmp(vertexData.data(), gameState.vertexData, sizeof(gameState.vertexData)) != 0) {
+		std::memcpy(vertexData.data(), gameState.vertexData, sizeof(gameState.vertexData));
+		gVertexDataDirty = true;
+	}
+}
+
+//Advances the game by one step. Must only depend on the current state and the
+//two inputs so netplay can rewind and re-run it.
+//player1Input drives the character and the left half, player2Input the right half.
+void SimulateTick(std::vector<GLfloat>& vertexData, Uint8 player1Input, Uint8 player2Input) {
+
 float stepSize = 0.0003f; //speed
 float jumpSize = 0.2f; //jump height
-float jumpSize2 = 1.0f;
-float maxVerticalVelocity = 1.0f; // Maximum upward velocity
-//const float maxJumpHeight = 0.01f;
-Uint64 currentTime = SDL_GetTicks();
-Uint64 lastTime = currentTime;
-//bool canJump = false;
 
 int i = 0;
 //g_vOffsetQuad5 += gGravity;
@@ -407,17 +1204,17 @@ float new_vOffsetQuad7 = g_vOffsetQuad7;
 
 
 
-if (state[SDL_SCANCODE_RIGHT]) {
+if (player1Input & INPUT_RIGHT) {
 	new_uOffsetQuad1 += stepSize;
 	//std::cout << "g_uOffset: " << new_uOffsetQuad1 << std::endl;
 }
 
 
-if (state[SDL_SCANCODE_LEFT]) {
+if (player1Input & INPUT_LEFT) {
 	new_uOffsetQuad1 -= stepSize;
 	//std::cout << "g_uOffset: " << new_uOffsetQuad1 << std::endl;
 }
-if (state[SDL_SCANCODE_UP] && isCollide) {
+if ((player1Input & INPUT_UP) && isCollide) {
 
 	//new_vOffsetQuad1 -= gGravity;
 	new_vOffsetQuad1 += jumpSize;
@@ -428,9 +1225,9 @@ if (state[SDL_SCANCODE_UP] && isCollide) {
 	//std::cout << "g_vOffset: " << new_vOffsetQuad1 << std::endl;
 }
 
-if ((state[SDL_SCANCODE_RIGHT] || state[SDL_SCANCODE_LEFT]) && state[SDL_SCANCODE_UP] && isCollide) {
+if ((player1Input & (INPUT_RIGHT | INPUT_LEFT)) && (player1Input & INPUT_UP) && isCollide) {
 	// Assuming horizontal velocity is half of the horizontal step size
-	float horizontalVelocity = (state[SDL_SCANCODE_RIGHT] ? stepSize : -stepSize) * 0.5f;
+	float horizontalVelocity = ((player1Input & INPUT_RIGHT) ? stepSize : -stepSize) * 0.5f;
 	new_vOffsetQuad1 += horizontalVelocity;
 	isCollide = false;
 }
@@ -459,6 +1256,9 @@ if (quad1Collider.position.y < quad2Collider.position.y + quad2Collider.size.y &
 	quad1Collider.position.x < quad2Collider.position.x + quad2Collider.size.x) {
 	// Collision detected with quad2 (Floor), prevent movement in the y-direction
 	new_vOffsetQuad1 = std::max(new_vOffsetQuad1, quad2Collider.position.y + quad2Collider.size.y);
+	if (!isCollide) {
+		RecordGameEvent(GAME_EVENT_LAND, 1, new_uOffsetQuad1, new_vOffsetQuad1 - gCharacterHalfSize);
+	}
 	isCollide = true;
 	//std::cout << "Collision detected with floor!" << std::endl;
 }
@@ -467,7 +1267,11 @@ if (quad1Collider.position.y < quad2Collider.position.y + quad2Collider.size.y &
 if (quad1Collider.position.x + quad1Collider.size.x > quad3Collider.position.x &&
 	quad1Collider.position.x < quad3Collider.position.x + quad3Collider.size.x) {
 	// Collision detected with quad3 (Left Wall), prevent movement past left wall
-	new_uOffsetQuad1 = std::max(new_uOffsetQuad1, quad3Collider.position.x + quad3Collider.size.x);
+	float leftWallStop = quad3Collider.position.x + quad3Collider.size.x;
+	if (new_uOffsetQuad1 < leftWallStop && g_uOffsetQuad1 > leftWallStop) {
+		RecordGameEvent(GAME_EVENT_WALL_HIT, 1, leftWallStop - gCharacterHalfSize, new_vOffsetQuad1);
+	}
+	new_uOffsetQuad1 = std::max(new_uOffsetQuad1, leftWallStop);
 	//std::cout << "Collision detected with Left Wall!" << std::endl;
 }
 
@@ -475,7 +1279,11 @@ if (quad1Collider.position.x + quad1Collider.size.x > quad3Collider.position.x &
 if (quad1Collider.position.x - quad1Collider.size.x < quad4Collider.position.x &&
 	quad1Collider.position.x > quad4Collider.position.x - quad4Collider.size.x) {
 	// Collision detected with quad4 (Right Wall), prevent movement past right wall
-	new_uOffsetQuad1 = std::min(new_uOffsetQuad1, quad4Collider.position.x - quad4Collider.size.x);
+	float rightWallStop = quad4Collider.position.x - quad4Collider.size.x;
+	if (new_uOffsetQuad1 > rightWallStop && g_uOffsetQuad1 < rightWallStop) {
+		RecordGameEvent(GAME_EVENT_WALL_HIT, 1, rightWallStop + gCharacterHalfSize, new_vOffsetQuad1);
+	}
+	new_uOffsetQuad1 = std::min(new_uOffsetQuad1, rightWallStop);
 	//std::cout << "Collision detected with Right Wall!" << std::endl;
 }
 
@@ -499,6 +1307,8 @@ if (quad5Collider.position.x + quad5Collider.size.x < quad1Collider.position.x +
 		float leftOfPlayer = quad1Collider.position.x - quad1Collider.size.x;
 		float rightOfPlayer = quad1Collider.position.x + quad1Collider.size.x;
 
+		RecordGameEvent(GAME_EVENT_SPLIT, 1, quad1Collider.position.x, quad1Collider.position.y);
+
 
 		//Left player position after collision
 		vertexData[120] = leftOfPlayer; //bottom left x
@@ -547,10 +1357,8 @@ if (quad5Collider.position.x + quad5Collider.size.x < quad1Collider.position.x +
 
 		
 
-		//Send to vertex shader
-		glBindBuffer(GL_ARRAY_BUFFER, gVertexBufferObject);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, vertexData.size() * sizeof(GLfloat), vertexData.data());
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		//Send to vertex shader (uploaded once in PreDraw, however many ticks ran)
+		gVertexDataDirty = true;
 	
 		
 	
@@ -570,24 +1378,34 @@ if (quad5Collider.position.x + quad5Collider.size.x < quad1Collider.position.x +
 			new_vOffsetQuad7 += gGravity;
 		}
 
-		if (isDivide && state[SDL_SCANCODE_RIGHT]) {
+		if (isDivide && (player1Input & INPUT_RIGHT)) {
 			new_uOffsetQuad6 += stepSize;
+		}
+		if (isDivide && (player2Input & INPUT_RIGHT)) {
 			new_uOffsetQuad7 += stepSize;
 		}
 
-		if (isDivide && state[SDL_SCANCODE_LEFT]) {
+		if (isDivide && (player1Input & INPUT_LEFT)) {
 			new_uOffsetQuad6 -= stepSize;
+		}
+		if (isDivide && (player2Input & INPUT_LEFT)) {
 			new_uOffsetQuad7 -= stepSize;
 		}
 
 		
-		 if (isDivide && state[SDL_SCANCODE_UP] && canJump) {
+		 if (isDivide && (player1Input & INPUT_UP) && canJump) {
 			new_vOffsetQuad6 += jumpSize;
-			new_vOffsetQuad7 += jumpSize;
 			new_vOffsetQuad6 += gGravity;
-			new_vOffsetQuad7 += gGravity;
 			canJump = false;
-			std::cout << "Can jump" << std::endl;
+			if (!gRollbackResimulating) {
+				std::cout << "Can jump" << std::endl;
+			}
+		}
+
+		 if (isDivide && (player2Input & INPUT_UP) && canJump2) {
+			new_vOffsetQuad7 += jumpSize;
+			new_vOffsetQuad7 += gGravity;
+			canJump2 = false;
 		}
 		
 		
@@ -602,17 +1420,35 @@ if (quad5Collider.position.x + quad5Collider.size.x < quad1Collider.position.x +
 			) {
 			// Collision detected with quad2 (Floor), prevent movement in the y-direction
 			new_vOffsetQuad6 = quad6Collider.size.y;
-			new_vOffsetQuad7 = quad7Collider.size.y;
+			if (!canJump) {
+				RecordGameEvent(GAME_EVENT_LAND, 6, (vertexData[120] + vertexData[126]) * 0.5f + new_uOffsetQuad6, -0.8f);
+			}
 			canJump = true;
 
 			//std::cout << "Collision detected with floor!: " << new_vOffsetQuad6 << std::endl;
 		}
 
+		if (quad7Collider.position.y - quad7Collider.size.y < 0) {
+			new_vOffsetQuad7 = quad7Collider.size.y;
+			if (!canJump2) {
+				RecordGameEvent(GAME_EVENT_LAND, 7, (vertexData[144] + vertexData[150]) * 0.5f + new_uOffsetQuad7, -0.8f);
+			}
+			canJump2 = true;
+		}
+
+
+		//Edge each half was stopped at this tick, for wall hit effects
+		bool quad6Clamped = false;
+		bool quad7Clamped = false;
+		float quad6HitX = 0.0f;
+		float quad7HitX = 0.0f;
 
 		// Check for collisions with right side of divider
 		if (quad6Collider.position.x + quad6Collider.size.x > quad5Collider.position.x - quad5Collider.size.x) {
 			// Collision detected with quad4 (Right Wall), prevent movement past right wall
 			new_uOffsetQuad6 = quad5Collider.position.x - quad5Collider.size.x;
+			quad6Clamped = true;
+			quad6HitX = vertexData[126] + new_uOffsetQuad6;
 			//std::cout << "Collision detected with Right Wall!" << std::endl;
 		}
 
@@ -620,6 +1456,8 @@ if (quad5Collider.position.x + quad5Collider.size.x < quad1Collider.position.x +
 		if (quad7Collider.position.x - quad7Collider.size.x < quad5Collider.position.x + quad5Collider.size.x) {
 			// Collision detected with quad4 (Right Wall), prevent movement past right wall
 			new_uOffsetQuad7 = quad5Collider.position.x - quad5Collider.size.x + .04f;
+			quad7Clamped = true;
+			quad7HitX = vertexData[150] + new_uOffsetQuad7;
 			//std::cout << "Collision detected with Right Wall!" << std::endl;
 		}
 
@@ -627,6 +1465,8 @@ if (quad5Collider.position.x + quad5Collider.size.x < quad1Collider.position.x +
 		if (quad6Collider.position.x - quad6Collider.size.x < quad3Collider.position.x + quad3Collider.size.x) {
 			// Collision detected with quad4 (Right Wall), prevent movement past right wall
 			new_uOffsetQuad6 = quad3Collider.position.x + quad5Collider.size.x + 0.17f;
+			quad6Clamped = true;
+			quad6HitX = vertexData[120] + new_uOffsetQuad6;
 			//std::cout << "Collision detected with Right Wall!" << std::endl;
 		}
 
@@ -634,8 +1474,18 @@ if (quad5Collider.position.x + quad5Collider.size.x < quad1Collider.position.x +
 		if (quad7Collider.position.x + quad7Collider.size.x > quad4Collider.position.x - quad4Collider.size.x) {
 			// Collision detected with quad4 (Right Wall), prevent movement past right wall
 			new_uOffsetQuad7 = quad4Collider.position.x - quad4Collider.size.x - 0.001f;
+			quad7Clamped = true;
+			quad7HitX = vertexData[144] + new_uOffsetQuad7;
 			//std::cout << "Collision detected with Right Wall!" << std::endl;
 		}
+
+		//The halves only exist once the character has been split
+		if (isDivide) {
+			TrackHalfWallContact(6, quad6Clamped, new_uOffsetQuad6, quad6HitX,
+				(vertexData[121] + vertexData[133]) * 0.5f + new_vOffsetQuad6, atWallQuad6, wallStopQuad6);
+			TrackHalfWallContact(7, quad7Clamped, new_uOffsetQuad7, quad7HitX,
+				(vertexData[145] + vertexData[157]) * 0.5f + new_vOffsetQuad7, atWallQuad7, wallStopQuad7);
+		}
 	
 	
 	
@@ -661,37 +1511,1237 @@ if (quad5Collider.position.x + quad5Collider.size.x < quad1Collider.position.x +
 
 }
 
-void PreDraw() {
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
-
-	glViewport(0, 0, gScreenWidth, gScreenHeight);
-	glClearColor(1.f, 1.f, 0.f, 1.f);
+//Netplay
+//Each process drives one half of the split over UDP. Every tick the game state
+//is saved into a ring and the remote player's input is predicted by repeating
+//their last confirmed input. When their real input arrives and disagrees with
+//the prediction we rewind to that tick and re-simulate up to the present.
+const int gRollbackRingSize = 512;    //Ticks of saved state and input
+const int gMaxPredictionTicks = 300;  //How far we may run ahead of the other player
+const int gSimulationTickRate = 1000; //Fixed simulation ticks per second, local play uses it too
+const int gMaxTicksPerFrame = 100;    //Catch-up limit after a long frame
+const Uint32 gNetplaySendIntervalMs = 4;      //The loop is uncapped, so packets are rate limited
+const Uint32 gMaxSimulatedLatencyMs = 1000;
+const int gNetplayDelayQueueSize = gMaxSimulatedLatencyMs / gNetplaySendIntervalMs + 16; //Fits every packet in flight
+const Uint32 gNetplayTimeoutMs = 5000;
+const Uint32 gNetplayMagic = 0x52424B32;
+const Uint32 gChecksumIntervalTicks = 256; //How often confirmed states are compared
+const int gChecksumHistorySize = 16;
+
+//Carries every local input the other side has not acknowledged yet,
+//so a lost packet is covered by the next one
+struct InputPacket {
+	Uint32 magic;
+	Uint32 firstTick; //Tick of inputs[0]
+	Uint32 ackTick;   //Sender has the receiver's inputs for every tick before this
+	Uint32 checksumTick; //Sender's latest confirmed state checksum, 0 if none yet
+	Uint32 checksum;
+	Uint32 count;
+	Uint8 inputs[gMaxPredictionTicks];
+};
 
-	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+const int gInputPacketHeaderSize = 6 * sizeof(Uint32);
 
-	glUseProgram(gGraphicsPipelineShaderProgram);
-	
-	
+//Outgoing packet held back to simulate latency
+struct DelayedPacket {
+	Uint32 releaseTime;
+	int size;
+	InputPacket packet;
+};
 
-	glm::mat4 translate5 = glm::translate(glm::mat4(1.0f), glm::vec3(g_uOffsetQuad5, g_vOffsetQuad5, 0.0f));
-	glm::mat4 translate = glm::translate(glm::mat4(1.0f), glm::vec3(g_uOffsetQuad1, g_vOffsetQuad1, 0.0f));
-	glm::mat4 translate6 = glm::translate(glm::mat4(1.0f), glm::vec3(g_uOffsetQuad6, g_vOffsetQuad6, 0.0f));
-	glm::mat4 translate7 = glm::translate(glm::mat4(1.0f), glm::vec3(g_uOffsetQuad7, g_vOffsetQuad7, 0.0f));
+struct NetplaySession {
+	bool enabled = false;
+	bool connected = false;
+	int localPlayer = 0; //0 drives the left half (quad6), 1 the right half (quad7)
+
+	NetSocket socket = INVALID_SOCKET;
+	sockaddr_in remoteAddress{};
+	Uint32 lastReceiveTime = 0;
+	Uint32 lastSendTime = 0;
+
+	//Simulated network conditions, applied to outgoing packets
+	Uint32 simulatedLatencyMs = 0;
+	int simulatedLossPercent = 0;
+	DelayedPacket delayQueue[gNetplayDelayQueueSize];
+	int delayQueueHead = 0;
+	int delayQueueCount = 0;
+
+	Uint32 currentTick = 0;          //Next tick to simulate
+	Uint32 remoteConfirmedTicks = 0; //We have the remote inputs for every tick before this
+	Uint32 remoteAckedTicks = 0;     //Remote has our inputs for every tick before this
+	bool needsRollback = false;
+	Uint32 rollbackTick = 0;         //Earliest mispredicted tick
+
+	Uint64 lastCounter = 0;
+	double tickAccumulator = 0.0;
+
+	GameState states[gRollbackRingSize]; //State at the start of each tick
+	Uint8 localInputs[gRollbackRingSize];
+	Uint8 remoteInputs[gRollbackRingSize]; //Confirmed input, or the prediction we simulated with
+
+	//Checksums of states both sides have the full input for, used to spot desyncs
+	Uint32 nextChecksumTick = gChecksumIntervalTicks;
+	Uint32 checksumTicks[gChecksumHistorySize];
+	Uint32 checksums[gChecksumHistorySize];
+	int checksumCount = 0;
+	Uint32 lastVerifiedChecksumTick = 0;
+
+	//Stats
+	Uint64 rollbacks = 0;
+	Uint64 resimulatedTicks = 0;
+	Uint32 longestRollback = 0;
+	Uint64 checksumsVerified = 0;
+	Uint64 desyncs = 0;
+};
 
-	//Retrieve our location of our Model Matrix
-	GLint u_ModelMatrixLocation = glGetUniformLocation(gGraphicsPipelineShaderProgram, "u_ModelMatrix");
-	GLint u_ModelMatrixLocation2 = glGetUniformLocation(gGraphicsPipelineShaderProgram, "u_ModelMatrix2");
-	GLint u_ModelMatrixLocation3 = glGetUniformLocation(gGraphicsPipelineShaderProgram, "u_ModelMatrix3");
-	GLuint u_ModelMatrixLocation4 = glGetUniformLocation(gGraphicsPipelineShaderProgram, "u_ModelMatrix4");
-	GLuint u_ModelMatrixLocation5 = glGetUniformLocation(gGraphicsPipelineShaderProgram, "u_ModelMatrix5");
+NetplaySession gNetplay;
 
-	if (u_ModelMatrixLocation >= 0) {
-		glUniformMatrix4fv(u_ModelMatrixLocation, 1, GL_FALSE, &translate[0][0]);
-	}
-	else {
-		std::cout << "Could not find u_ModelMatrix. \n";
-		exit(EXIT_FAILURE);
+void NetplayStart(int localPlayer, int localPort, const char* remoteHost, int remotePort, Uint32 latencyMs, int lossPercent) {
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+		std::cout << "Winsock could not be initialized" << std::endl;
+		exit(1);
+	}
+#endif
+
+	gNetplay.socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (gNetplay.socket == INVALID_SOCKET) {
+		std::cout << "Netplay socket could not be created" << std::endl;
+		exit(1);
+	}
+
+	sockaddr_in localAddress{};
+	localAddress.sin_family = AF_INET;
+	localAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+	localAddress.sin_port = htons(static_cast<Uint16>(localPort));
+	if (bind(gNetplay.socket, reinterpret_cast<sockaddr*>(&localAddress), sizeof(localAddress)) != 0) {
+		std::cout << "Netplay could not bind to port " << localPort << std::endl;
+		exit(1);
+	}
+
+	//Never block the frame waiting for packets
+#ifdef _WIN32
+	u_long nonBlocking = 1;
+	ioctlsocket(gNetplay.socket, FIONBIO, &nonBlocking);
+#else
+	fcntl(gNetplay.socket, F_SETFL, fcntl(gNetplay.socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	gNetplay.remoteAddress.sin_family = AF_INET;
+	gNetplay.remoteAddress.sin_port = htons(static_cast<Uint16>(remotePort));
+	if (inet_pton(AF_INET, remoteHost, &gNetplay.remoteAddress.sin_addr) != 1) {
+		std::cout << "Netplay remote address is not a valid IPv4 address: " << remoteHost << std::endl;
+		exit(1);
+	}
+
+	gNetplay.enabled = true;
+	gNetplay.localPlayer = localPlayer;
+	gDedupeGameEvents = true;
+	gNetplay.simulatedLatencyMs = std::min(latencyMs, gMaxSimulatedLatencyMs);
+	gNetplay.simulatedLossPercent = lossPercent;
+
+	std::cout << "Netplay: player " << localPlayer + 1 << " on port " << localPort
+		<< ", waiting for " << remoteHost << ":" << remotePort << std::endl;
+}
+
+void NetplayStop() {
+	if (!gNetplay.enabled) {
+		return;
+	}
+
+	std::cout << "Netplay rollbacks: " << gNetplay.rollbacks
+		<< ", re-simulated ticks: " << gNetplay.resimulatedTicks
+		<< ", longest rollback: " << gNetplay.longestRollback << " ticks" << std::endl;
+	std::cout << "Netplay checksums verified: " << gNetplay.checksumsVerified
+		<< ", desyncs: " << gNetplay.desyncs << std::endl;
+
+#ifdef _WIN32
+	closesocket(gNetplay.socket);
+	WSACleanup();
+#else
+	close(gNetplay.socket);
+#endif
+	gNetplay.enabled = false;
+}
+
+//FNV-1a over every field, skipping struct padding
+Uint32 GameStateChecksum(const GameState& gameState) {
+	Uint32 hash = 2166136261u;
+	auto mix = [&hash](const void* data, size_t size) {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ bytes[i]) * 16777619u;
+		}
+	};
+
+	mix(&gameState.uOffsetQuad1, sizeof(float) * 8);
+	mix(&gameState.isCollide, sizeof(bool));
+	mix(&gameState.isDivide, sizeof(bool));
+	mix(&gameState.canJump, sizeof(bool));
+	mix(&gameState.canJump2, sizeof(bool));
+	mix(&gameState.atWallQuad6, sizeof(bool));
+	mix(&gameState.atWallQuad7, sizeof(bool));
+	mix(&gameState.wallStopQuad6, sizeof(float));
+	mix(&gameState.wallStopQuad7, sizeof(float));
+	const Collider* colliders[4] = { &gameState.quad1Collider, &gameState.quad5Collider, &gameState.quad6Collider, &gameState.quad7Collider };
+	for (const Collider* collider : colliders) {
+		mix(&collider->position, sizeof(float) * 2);
+		mix(&collider->size, sizeof(float) * 2);
+	}
+	mix(gameState.vertexData, sizeof(gameState.vertexData));
+
+	return hash;
+}
+
+//Once every input before a checksum tick is confirmed, the state saved at that tick is final
+void NetplayUpdateChecksums() {
+	while (gNetplay.nextChecksumTick <= gNetplay.remoteConfirmedTicks && gNetplay.nextChecksumTick < gNetplay.currentTick) {
+		int slot = gNetplay.checksumCount % gChecksumHistorySize;
+		gNetplay.checksumTicks[slot] = gNetplay.nextChecksumTick;
+		gNetplay.checksums[slot] = GameStateChecksum(gNetplay.states[gNetplay.nextChecksumTick % gRollbackRingSize]);
+		gNetplay.checksumCount++;
+		gNetplay.nextChecksumTick += gChecksumIntervalTicks;
+	}
+}
+
+void NetplayVerifyChecksum(Uint32 tick, Uint32 checksum) {
+	if (tick == 0 || tick <= gNetplay.lastVerifiedChecksumTick) {
+		return;
+	}
+
+	//Not found means we haven't got that far yet, the remote keeps sending it
+	for (int i = 0; i < gChecksumHistorySize && i < gNetplay.checksumCount; i++) {
+		if (gNetplay.checksumTicks[i] != tick) {
+			continue;
+		}
+
+		gNetplay.lastVerifiedChecksumTick = tick;
+		gNetplay.checksumsVerified++;
+		if (gNetplay.checksums[i] != checksum) {
+			gNetplay.desyncs++;
+			std::cout << "Netplay: desync at tick " << tick << std::endl;
+		}
+		return;
+	}
+}
+
+void NetplayFlushDelayQueue() {
+	Uint32 now = SDL_GetTicks();
+
+	//Latency is constant, so packets leave in the order they were queued
+	while (gNetplay.delayQueueCount > 0) {
+		DelayedPacket& delayed = gNetplay.delayQueue[gNetplay.delayQueueHead];
+		if (now < delayed.releaseTime) {
+			break;
+		}
+
+		sendto(gNetplay.socket, reinterpret_cast<const char*>(&delayed.packet), delayed.size, 0,
+			reinterpret_cast<const sockaddr*>(&gNetplay.remoteAddress), sizeof(gNetplay.remoteAddress));
+
+		gNetplay.delayQueueHead = (gNetplay.delayQueueHead + 1) % gNetplayDelayQueueSize;
+		gNetplay.delayQueueCount--;
+	}
+}
+
+void NetplaySend() {
+	NetplayFlushDelayQueue();
+
+	//Every packet carries all unacked inputs, so skipping frames loses nothing
+	Uint32 now = SDL_GetTicks();
+	if (now - gNetplay.lastSendTime < gNetplaySendIntervalMs) {
+		return;
+	}
+	gNetplay.lastSendTime = now;
+
+	if (std::rand() % 100 < gNetplay.simulatedLossPercent) {
+		return;
+	}
+
+	//A full queue behaves like a dropped packet
+	if (gNetplay.delayQueueCount == gNetplayDelayQueueSize) {
+		return;
+	}
+
+	int tail = (gNetplay.delayQueueHead + gNetplay.delayQueueCount) % gNetplayDelayQueueSize;
+	DelayedPacket& delayed = gNetplay.delayQueue[tail];
+	gNetplay.delayQueueCount++;
+
+	Uint32 count = gNetplay.currentTick - gNetplay.remoteAckedTicks;
+	delayed.packet.magic = htonl(gNetplayMagic);
+	delayed.packet.firstTick = htonl(gNetplay.remoteAckedTicks);
+	delayed.packet.ackTick = htonl(gNetplay.remoteConfirmedTicks);
+	delayed.packet.checksumTick = 0;
+	delayed.packet.checksum = 0;
+	if (gNetplay.checksumCount > 0) {
+		int latest = (gNetplay.checksumCount - 1) % gChecksumHistorySize;
+		delayed.packet.checksumTick = htonl(gNetplay.checksumTicks[latest]);
+		delayed.packet.checksum = htonl(gNetplay.checksums[latest]);
+	}
+	delayed.packet.count = htonl(count);
+	for (Uint32 i = 0; i < count; i++) {
+		delayed.packet.inputs[i] = gNetplay.localInputs[(gNetplay.remoteAckedTicks + i) % gRollbackRingSize];
+	}
+	delayed.size = gInputPacketHeaderSize + static_cast<int>(count);
+	delayed.releaseTime = now + gNetplay.simulatedLatencyMs;
+
+	NetplayFlushDelayQueue();
+}
+
+void NetplayReceive() {
+	InputPacket packet;
+
+	while (true) {
+		sockaddr_in from{};
+		socklen_t fromLength = sizeof(from);
+		int received = static_cast<int>(recvfrom(gNetplay.socket, reinterpret_cast<char*>(&packet), sizeof(packet), 0,
+			reinterpret_cast<sockaddr*>(&from), &fromLength));
+
+		if (received < 0) {
+			break; //Nothing left to read
+		}
+
+		//Only the peer we were pointed at gets to drive the other half
+		if (fromLength < static_cast<socklen_t>(sizeof(from)) || from.sin_family != AF_INET ||
+			from.sin_addr.s_addr != gNetplay.remoteAddress.sin_addr.s_addr ||
+			from.sin_port != gNetplay.remoteAddress.sin_port) {
+			continue;
+		}
+		if (received < gInputPacketHeaderSize || ntohl(packet.magic) != gNetplayMagic) {
+			continue;
+		}
+
+		Uint32 firstTick = ntohl(packet.firstTick);
+		Uint32 ackTick = ntohl(packet.ackTick);
+		Uint32 count = ntohl(packet.count);
+		if (count > static_cast<Uint32>(received - gInputPacketHeaderSize)) {
+			continue;
+		}
+
+		if (!gNetplay.connected) {
+			std::cout << "Netplay: connected to player " << 2 - gNetplay.localPlayer << std::endl;
+			gNetplay.connected = true;
+			gNetplay.lastCounter = SDL_GetPerformanceCounter();
+		}
+		gNetplay.lastReceiveTime = SDL_GetTicks();
+
+		if (ackTick > gNetplay.remoteAckedTicks && ackTick <= gNetplay.currentTick) {
+			gNetplay.remoteAckedTicks = ackTick;
+		}
+
+		NetplayVerifyChecksum(ntohl(packet.checksumTick), ntohl(packet.checksum));
+
+		for (Uint32 i = 0; i < count; i++) {
+			Uint32 tick = firstTick + i;
+			if (tick < gNetplay.remoteConfirmedTicks) {
+				continue; //Already have it
+			}
+			if (tick > gNetplay.remoteConfirmedTicks) {
+				break; //Gap, wait for a packet that fills it
+			}
+
+			int slot = tick % gRollbackRingSize;
+			Uint8 input = packet.inputs[i];
+
+			//We already simulated this tick with a guess, rewind if it was wrong
+			if (tick < gNetplay.currentTick && gNetplay.remoteInputs[slot] != input) {
+				if (!gNetplay.needsRollback || tick < gNetplay.rollbackTick) {
+					gNetplay.rollbackTick = tick;
+				}
+				gNetplay.needsRollback = true;
+			}
+
+			gNetplay.remoteInputs[slot] = input;
+			gNetplay.remoteConfirmedTicks++;
+		}
+	}
+}
+
+Uint8 NetplayPredictRemoteInput() {
+	if (gNetplay.remoteConfirmedTicks == 0) {
+		return 0;
+	}
+	return gNetplay.remoteInputs[(gNetplay.remoteConfirmedTicks - 1) % gRollbackRingSize];
+}
+
+void NetplaySimulateTick(std::vector<GLfloat>& vertexData, Uint32 tick) {
+	int slot = tick % gRollbackRingSize;
+
+	if (tick >= gNetplay.remoteConfirmedTicks) {
+		gNetplay.remoteInputs[slot] = NetplayPredictRemoteInput();
+	}
+
+	SaveGameState(gNetplay.states[slot], vertexData);
+
+	gSimulationTick = tick;
+	Uint8 localInput = gNetplay.localInputs[slot];
+	Uint8 remoteInput = gNetplay.remoteInputs[slot];
+	if (gNetplay.localPlayer == 0) {
+		SimulateTick(vertexData, localInput, remoteInput);
+	}
+	else {
+		SimulateTick(vertexData, remoteInput, localInput);
+	}
+}
+
+void NetplayRollback(std::vector<GLfloat>& vertexData) {
+	if (!gNetplay.needsRollback) {
+		return;
+	}
+	gNetplay.needsRollback = false;
+
+	Uint32 depth = gNetplay.currentTick - gNetplay.rollbackTick;
+	LoadGameState(gNetplay.states[gNetplay.rollbackTick % gRollbackRingSize], vertexData);
+
+	gRollbackResimulating = true;
+	for (Uint32 tick = gNetplay.rollbackTick; tick < gNetplay.currentTick; tick++) {
+		NetplaySimulateTick(vertexData, tick);
+	}
+	gRollbackResimulating = false;
+
+	gNetplay.rollbacks++;
+	gNetplay.resimulatedTicks += depth;
+	if (depth > gNetplay.longestRollback) {
+		gNetplay.longestRollback = depth;
+	}
+}
+
+bool SceneAssetsReady() {
+	return gVertexArrayObject != 0 && gGraphicsPipelineShaderProgram != 0;
+}
+
+void NetplayUpdate(std::vector<GLfloat>& vertexData, Uint8 localInput) {
+	NetplayReceive();
+
+	//Keep saying hello until the other side answers
+	if (!gNetplay.connected) {
+		NetplaySend();
+		return;
+	}
+
+	if (SDL_GetTicks() - gNetplay.lastReceiveTime > gNetplayTimeoutMs) {
+		std::cout << "Netplay: lost connection to the other player" << std::endl;
+		gQuit = true;
+		return;
+	}
+
+	//Stay connected while loading, but don't bank the time for a burst of ticks afterwards
+	if (!SceneAssetsReady()) {
+		gNetplay.lastCounter = SDL_GetPerformanceCounter();
+		NetplaySend();
+		return;
+	}
+
+	NetplayRollback(vertexData);
+
+	//Run however many fixed ticks the elapsed time calls for
+	Uint64 counter = SDL_GetPerformanceCounter();
+	gNetplay.tickAccumulator += static_cast<double>(counter - gNetplay.lastCounter) * gSimulationTickRate / SDL_GetPerformanceFrequency();
+	gNetplay.lastCounter = counter;
+
+	int ticksThisFrame = 0;
+	while (gNetplay.tickAccumulator >= 1.0 && ticksThisFrame < gMaxTicksPerFrame) {
+		//Don't run further ahead than we can rewind or resend
+		int ticksPredicted = static_cast<int>(gNetplay.currentTick - gNetplay.remoteConfirmedTicks);
+		int ticksUnacked = static_cast<int>(gNetplay.currentTick - gNetplay.remoteAckedTicks);
+		if (ticksPredicted >= gMaxPredictionTicks || ticksUnacked >= gMaxPredictionTicks) {
+			break;
+		}
+
+		gNetplay.localInputs[gNetplay.currentTick % gRollbackRingSize] = localInput;
+		NetplaySimulateTick(vertexData, gNetplay.currentTick);
+		gNetplay.currentTick++;
+
+		gNetplay.tickAccumulator -= 1.0;
+		ticksThisFrame++;
+	}
+
+	//Don't bank time while stalled, it would come out as one big burst later
+	if (gNetplay.tickAccumulator > gMaxTicksPerFrame) {
+		gNetplay.tickAccumulator = gMaxTicksPerFrame;
+	}
+
+	NetplayUpdateChecksums();
+
+	NetplaySend();
+}
+
+//Local play steps the same fixed tick as netplay, so the game runs at the same
+//speed in both and doesn't depend on the frame rate
+Uint64 gLocalLastCounter = 0;
+double gLocalTickAccumulator = 0.0;
+
+void LocalUpdate(std::vector<GLfloat>& vertexData, Uint8 localInput) {
+	//Nothing moves until the scene is on screen
+	if (!SceneAssetsReady()) {
+		gLocalLastCounter = 0;
+		return;
+	}
+
+	Uint64 counter = SDL_GetPerformanceCounter();
+	if (gLocalLastCounter == 0) {
+		gLocalLastCounter = counter;
+	}
+	gLocalTickAccumulator += static_cast<double>(counter - gLocalLastCounter) * gSimulationTickRate / SDL_GetPerformanceFrequency();
+	gLocalLastCounter = counter;
+
+	int ticksThisFrame = 0;
+	while (gLocalTickAccumulator >= 1.0 && ticksThisFrame < gMaxTicksPerFrame) {
+		//One keyboard drives both halves
+		SimulateTick(vertexData, localInput, localInput);
+		gSimulationTick++;
+
+		gLocalTickAccumulator -= 1.0;
+		ticksThisFrame++;
+	}
+
+	//Drop time we couldn't catch up on rather than bursting through it later
+	if (gLocalTickAccumulator > gMaxTicksPerFrame) {
+		gLocalTickAccumulator = gMaxTicksPerFrame;
+	}
+}
+
+void Input(std::vector<GLfloat>& vertexData) {
+	Uint8 localInput = PollInput();
+
+	if (gNetplay.enabled) {
+		NetplayUpdate(vertexData, localInput);
+	}
+	else {
+		LocalUpdate(vertexData, localInput);
+	}
+}
+
+//GPU Particles
+//Debris is simulated entirely on the GPU with transform feedback. Two buffers
+//are ping-ponged: each frame the update program reads one and writes the other,
+//and the CPU never reads anything back. Bursts are handed to the update
+//program as uniforms and claim a range of particle slots round-robin.
+void CreateParticleSystem() {
+	std::unique_ptr<AssetLoad> load(new AssetLoad());
+	load->files = { "./particle_update.glsl", "./particle_vert.glsl", "./particle_frag.glsl" };
+
+	load->upload = [](AssetLoad& self) {
+		const char* varyings[] = { "tf_position", "tf_velocity", "tf_ageLife" };
+		self.objects[0] = CreateTransformFeedbackProgram(self.contents[0], varyings, 3);
+		self.objects[1] = CreateShaderProgram(self.contents[1], self.contents[2]);
+
+		//All zero means every particle starts out dead
+		std::vector<GLfloat> initialParticles(gParticleCapacity * gParticleFloatCount, 0.0f);
+		glGenBuffers(2, &self.objects[2]);
+		for (int i = 0; i < 2; i++) {
+			glBindBuffer(GL_ARRAY_BUFFER, self.objects[2 + i]);
+			glBufferData(GL_ARRAY_BUFFER,
+				initialParticles.size() * sizeof(GLfloat),
+				initialParticles.data(),
+				GL_DYNAMIC_COPY); //Written and read by the GPU only
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	};
+
+	load->finish = [](AssetLoad& self) {
+		gParticleBuffers[0] = self.objects[2];
+		gParticleBuffers[1] = self.objects[3];
+
+		//One VAO per buffer, used both as the update input and for drawing
+		glGenVertexArrays(2, gParticleVertexArrays);
+		for (int i = 0; i < 2; i++) {
+			glBindVertexArray(gParticleVertexArrays[i]);
+			glBindBuffer(GL_ARRAY_BUFFER, gParticleBuffers[i]);
+
+			for (GLuint attribute = 0; attribute < 3; attribute++) {
+				glEnableVertexAttribArray(attribute);
+				glVertexAttribPointer(attribute,
+					2,
+					GL_FLOAT,
+					GL_FALSE,
+					sizeof(GLfloat) * gParticleFloatCount,
+					(GLvoid*)(sizeof(GLfloat) * 2 * attribute)
+					);
+			}
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		GLuint update = self.objects[0];
+		gParticleUniforms.deltaTime = glGetUniformLocation(update, "u_DeltaTime");
+		gParticleUniforms.gravity = glGetUniformLocation(update, "u_Gravity");
+		gParticleUniforms.floor = glGetUniformLocation(update, "u_Floor");
+		gParticleUniforms.seed = glGetUniformLocation(update, "u_Seed");
+		gParticleUniforms.particleCount = glGetUniformLocation(update, "u_ParticleCount");
+		gParticleUniforms.burstCount = glGetUniformLocation(update, "u_BurstCount");
+		gParticleUniforms.burstRange = glGetUniformLocation(update, "u_BurstRange");
+		gParticleUniforms.burstShape = glGetUniformLocation(update, "u_BurstShape");
+		gParticleUniforms.burstMotion = glGetUniformLocation(update, "u_BurstMotion");
+		gParticleUniforms.pointSize = glGetUniformLocation(self.objects[1], "u_PointSize");
+
+		gParticleUpdateProgram = update;
+		gParticleRenderProgram = self.objects[1];
+	};
+
+	QueueAssetLoad(std::move(load));
+}
+
+//Turns this frame's gameplay events into bursts and steps the simulation
+void UpdateParticles(const FrameVector<GameEvent>& events, float deltaTime) {
+	if (gParticleUpdateProgram == 0) {
+		return;
+	}
+
+	GLint burstRange[gMaxParticleBursts * 2];
+	GLfloat burstShape[gMaxParticleBursts * 4];
+	GLfloat burstMotion[gMaxParticleBursts * 2];
+	int burstCount = 0;
+
+	for (const GameEvent& gameEvent : events) {
+		if (burstCount == gMaxParticleBursts) {
+			break;
+		}
+
+		int count = 0;
+		float speed = 0.0f;
+		float lifetime = 0.0f;
+		glm::vec2 spread;
+
+		if (gameEvent.type == GAME_EVENT_SPLIT) {
+			count = 20000;
+			speed = 1.2f;
+			lifetime = 2.5f;
+			spread = glm::vec2(0.09f, 0.09f);
+		}
+		else if (gameEvent.type == GAME_EVENT_LAND) {
+			count = 1500;
+			speed = 0.4f;
+			lifetime = 0.8f;
+			spread = glm::vec2(0.09f, 0.0f);
+		}
+		else {
+			count = 800;
+			speed = 0.5f;
+			lifetime = 0.6f;
+			spread = glm::vec2(0.0f, 0.09f);
+		}
+
+		burstRange[burstCount * 2 + 0] = gParticleCursor;
+		burstRange[burstCount * 2 + 1] = count;
+		burstShape[burstCount * 4 + 0] = gameEvent.position.x;
+		burstShape[burstCount * 4 + 1] = gameEvent.position.y;
+		burstShape[burstCount * 4 + 2] = spread.x;
+		burstShape[burstCount * 4 + 3] = spread.y;
+		burstMotion[burstCount * 2 + 0] = speed;
+		burstMotion[burstCount * 2 + 1] = lifetime;
+		burstCount++;
+
+		gParticleCursor = (gParticleCursor + count) % gParticleCapacity;
+		gParticlesAliveUntil = std::max(gParticlesAliveUntil, gParticleTime + lifetime);
+	}
+
+	gParticleTime += deltaTime;
+
+	//Nothing alive and nothing new, skip the GPU work entirely
+	if (burstCount == 0 && gParticleTime > gParticlesAliveUntil) {
+		return;
+	}
+
+	glUseProgram(gParticleUpdateProgram);
+	glUniform1f(gParticleUniforms.deltaTime, deltaTime);
+	glUniform1f(gParticleUniforms.gravity, gParticleGravity);
+	glUniform1f(gParticleUniforms.floor, gParticleFloor);
+	glUniform1ui(gParticleUniforms.seed, gParticleSeed++ * 2654435761u);
+	glUniform1i(gParticleUniforms.particleCount, gParticleCapacity);
+	glUniform1i(gParticleUniforms.burstCount, burstCount);
+	if (burstCount > 0) {
+		glUniform2iv(gParticleUniforms.burstRange, burstCount, burstRange);
+		glUniform4fv(gParticleUniforms.burstShape, burstCount, burstShape);
+		glUniform2fv(gParticleUniforms.burstMotion, burstCount, burstMotion);
+	}
+
+	int destination = 1 - gParticleSource;
+
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindVertexArray(gParticleVertexArrays[gParticleSource]);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, gParticleBuffers[destination]);
+
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, gParticleCapacity);
+	glEndTransformFeedback();
+
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glBindVertexArray(0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	glUseProgram(0);
+
+	gParticleSource = destination;
+}
+
+//Draws into whatever PreDraw() set up, after the scene
+void DrawParticles() {
+	if (gParticleRenderProgram == 0 || gParticleTime > gParticlesAliveUntil) {
+		return;
+	}
+
+	glUseProgram(gParticleRenderProgram);
+	//Keep particles the same size on screen whatever the render resolution
+	glUniform1f(gParticleUniforms.pointSize, gParticlePointSize * gRenderStats.resolutionScale);
+
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glBindVertexArray(gParticleVertexArrays[gParticleSource]);
+	glDrawArrays(GL_POINTS, 0, gParticleCapacity);
+
+	glBindVertexArray(0);
+	glDisable(GL_BLEND);
+	glDisable(GL_PROGRAM_POINT_SIZE);
+	glUseProgram(0);
+}
+
+//Sprites
+//Images listed in sprites.txt are packed into atlas pages at startup and
+//uploaded as one texture array, one layer per page. Every vertex carries a
+//(u, v, layer) texture coordinate, layer -1 meaning "use the vertex color",
+//so world quads, skinned quads and sprites all go out in the same
+//glDrawElements call.
+
+//Decodes an uncompressed or RLE true-color TGA into RGBA rows, bottom row first
+bool DecodeTGA(const std::string& data, SpriteImage& image) {
+	if (data.size() < 18) {
+		return false;
+	}
+
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data());
+	int idLength = bytes[0];
+	int colorMapType = bytes[1];
+	int imageType = bytes[2];
+	int colorMapLength = bytes[5] | (bytes[6] << 8);
+	int colorMapEntryBits = bytes[7];
+	int width = bytes[12] | (bytes[13] << 8);
+	int height = bytes[14] | (bytes[15] << 8);
+	int bitsPerPixel = bytes[16];
+	bool topOrigin = (bytes[17] & 0x20) != 0;
+
+	if ((imageType != 2 && imageType != 10) || (bitsPerPixel != 24 && bitsPerPixel != 32) || width == 0 || height == 0) {
+		return false;
+	}
+
+	//Anything bigger could never be packed, so don't spend memory decoding it
+	if (width > gAtlasPageSize || height > gAtlasPageSize) {
+		return false;
+	}
+
+	//True-color images can still carry a color map, it sits between the ID and the pixels
+	int bytesPerPixel = bitsPerPixel / 8;
+	size_t pixelCount = static_cast<size_t>(width) * height;
+	size_t offset = 18 + idLength;
+	if (colorMapType != 0) {
+		offset += static_cast<size_t>(colorMapLength) * ((colorMapEntryBits + 7) / 8);
+	}
+
+	//Check the file can hold the pixels before allocating for them: raw data is
+	//exact, RLE needs at least one header and one pixel per 128 pixels
+	size_t minimumPixelBytes = imageType == 2
+		? pixelCount * bytesPerPixel
+		: (pixelCount + 127) / 128 * (1 + bytesPerPixel);
+	if (offset > data.size() || data.size() - offset < minimumPixelBytes) {
+		return false;
+	}
+
+	image.width = width;
+	image.height = height;
+	image.pixels.assign(pixelCount * 4, 0);
+
+	//Reads one BGR(A) pixel into pixel index i
+	auto readPixel = [&](size_t i) {
+		if (offset + bytesPerPixel > data.size()) {
+			return false;
+		}
+		size_t row = i / width;
+		size_t column = i % width;
+		if (topOrigin) {
+			row = height - 1 - row;
+		}
+		unsigned char* out = &image.pixels[(row * width + column) * 4];
+		out[0] = bytes[offset + 2];
+		out[1] = bytes[offset + 1];
+		out[2] = bytes[offset + 0];
+		out[3] = bytesPerPixel == 4 ? bytes[offset + 3] : 255;
+		return true;
+	};
+
+	size_t i = 0;
+	while (i < pixelCount) {
+		if (imageType == 2) {
+			if (!readPixel(i)) {
+				return false;
+			}
+			offset += bytesPerPixel;
+			i++;
+			continue;
+		}
+
+		//RLE packet: high bit set means one pixel repeated, otherwise raw pixels
+		if (offset >= data.size()) {
+			return false;
+		}
+		int header = bytes[offset++];
+		int count = (header & 0x7F) + 1;
+		bool repeated = (header & 0x80) != 0;
+		for (int j = 0; j < count && i < pixelCount; j++, i++) {
+			if (!readPixel(i)) {
+				return false;
+			}
+			if (!repeated) {
+				offset += bytesPerPixel;
+			}
+		}
+		if (repeated) {
+			offset += bytesPerPixel;
+		}
+	}
+
+	return true;
+}
+
+//Shelf packer: tallest images first, left to right in rows, a new page when one fills up
+void PackSpriteAtlas(SpriteAtlasBuild& build) {
+	std::vector<int> order;
+	for (int i = 0; i < static_cast<int>(build.images.size()); i++) {
+		order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&build](int a, int b) {
+		return build.images[a].height > build.images[b].height;
+	});
+
+	int page = -1;
+	int cursorX = 0;
+	int shelfY = 0;
+	int shelfHeight = 0;
+
+	for (int index : order) {
+		SpriteImage& image = build.images[index];
+		int paddedWidth = image.width + gAtlasPadding;
+		int paddedHeight = image.height + gAtlasPadding;
+
+		if (paddedWidth > gAtlasPageSize || paddedHeight > gAtlasPageSize) {
+			std::cout << "Sprite " << image.name << " is larger than an atlas page" << std::endl;
+			continue;
+		}
+
+		//Next shelf, then next page
+		if (page >= 0 && cursorX + paddedWidth > gAtlasPageSize) {
+			shelfY += shelfHeight;
+			cursorX = 0;
+			shelfHeight = 0;
+		}
+		if (page < 0 || shelfY + paddedHeight > gAtlasPageSize) {
+			page++;
+			build.pages.push_back(std::vector<unsigned char>(gAtlasPageSize * gAtlasPageSize * 4, 0));
+			cursorX = 0;
+			shelfY = 0;
+			shelfHeight = 0;
+		}
+
+		std::vector<unsigned char>& pixels = build.pages[page];
+		for (int row = 0; row < image.height; row++) {
+			std::memcpy(&pixels[((shelfY + row) * gAtlasPageSize + cursorX) * 4],
+				&image.pixels[row * image.width * 4],
+				image.width * 4);
+		}
+
+		SpriteFrame frame;
+		frame.name = image.name;
+		frame.layer = page;
+		frame.u0 = static_cast<float>(cursorX) / gAtlasPageSize;
+		frame.v0 = static_cast<float>(shelfY) / gAtlasPageSize;
+		frame.u1 = static_cast<float>(cursorX + image.width) / gAtlasPageSize;
+		frame.v1 = static_cast<float>(shelfY + image.height) / gAtlasPageSize;
+		build.frames.push_back(frame);
+
+		cursorX += paddedWidth;
+		shelfHeight = std::max(shelfHeight, paddedHeight);
+	}
+
+	//The pixels live in the pages now
+	build.images.clear();
+}
+
+int FindSprite(const std::string& name) {
+	for (int i = 0; i < static_cast<int>(gSpriteFrames.size()); i++) {
+		if (gSpriteFrames[i].name == name) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+//Queues a sprite for this frame, positions are in clip space like everything else
+void SubmitSprite(int frame, float x, float y, float width, float height, int depth) {
+	if (gFrameSprites == nullptr || frame < 0) {
+		return;
+	}
+	SpriteDraw sprite;
+	sprite.frame = frame;
+	sprite.position = glm::vec2(x, y);
+	sprite.size = glm::vec2(width, height);
+	sprite.depth = depth;
+	sprite.order = static_cast<int>(gFrameSprites->size());
+	gFrameSprites->push_back(sprite);
+}
+
+//Points a world quad's four vertices at an atlas frame
+void SkinQuad(int quad, const SpriteFrame& frame) {
+	GLfloat* texCoords = &gQuadTexCoords[quad * 4 * 3];
+	GLfloat corners[4][2] = {
+		{ frame.u0, frame.v0 }, //Bottom left
+		{ frame.u1, frame.v0 }, //Bottom right
+		{ frame.u0, frame.v1 }, //Top left
+		{ frame.u1, frame.v1 }  //Top right
+	};
+	for (int vertex = 0; vertex < 4; vertex++) {
+		texCoords[vertex * 3 + 0] = corners[vertex][0];
+		texCoords[vertex * 3 + 1] = corners[vertex][1];
+		texCoords[vertex * 3 + 2] = static_cast<float>(frame.layer);
+	}
+	gTexCoordsDirty = true;
+}
+
+//Reads sprites.txt:  name image.tga [x y width height [depth]]
+//Names matching a world quad skin it, entries with a placement are drawn every frame.
+void CreateSpriteAtlas() {
+	std::unique_ptr<AssetLoad> load(new AssetLoad());
+	load->files = { "./sprites.txt" };
+	std::shared_ptr<SpriteAtlasBuild> build = std::make_shared<SpriteAtlasBuild>();
+
+	//Image reads, decoding and packing all stay on the worker
+	load->decode = [build](AssetLoad& self) {
+		std::istringstream manifest(self.contents[0]);
+		std::string line;
+		while (std::getline(manifest, line)) {
+			std::istringstream fields(line);
+			std::string name;
+			std::string file;
+			if (!(fields >> name >> file) || name[0] == '#') {
+				continue;
+			}
+
+			SpriteImage image;
+			image.name = name;
+			if (!DecodeTGA(LoadFileAsString(file), image)) {
+				std::cout << "Could not decode sprite " << file << std::endl;
+				continue;
+			}
+			build->images.push_back(std::move(image));
+
+			SpriteDraw placement;
+			if (fields >> placement.position.x >> placement.position.y >> placement.size.x >> placement.size.y) {
+				if (!(fields >> placement.depth)) {
+					placement.depth = 0;
+				}
+				placement.order = static_cast<int>(build->placements.size());
+				build->placements.push_back(placement);
+				build->placementNames.push_back(name);
+			}
+		}
+
+		PackSpriteAtlas(*build);
+	};
+
+	load->upload = [build](AssetLoad& self) {
+		if (build->pages.empty()) {
+			return;
+		}
+
+		glGenTextures(1, &self.objects[0]);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, self.objects[0]);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8,
+			gAtlasPageSize, gAtlasPageSize, static_cast<GLsizei>(build->pages.size()),
+			0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		for (size_t page = 0; page < build->pages.size(); page++) {
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0,
+				0, 0, static_cast<GLint>(page),
+				gAtlasPageSize, gAtlasPageSize, 1,
+				GL_RGBA, GL_UNSIGNED_BYTE, build->pages[page].data());
+		}
+
+		//Nearest so neighbouring sprites never bleed into each other
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	};
+
+	load->finish = [build](AssetLoad& self) {
+		if (self.objects[0] == 0) {
+			return;
+		}
+
+		gSpriteAtlasTexture = self.objects[0];
+		gSpriteFrames = std::move(build->frames);
+		std::cout << "Sprite atlas: " << gSpriteFrames.size() << " sprites on " << build->pages.size() << " page(s)" << std::endl;
+
+		const char* quadNames[7] = { "character", "floor", "leftwall", "rightwall", "divider", "leftplayer", "rightplayer" };
+		for (int quad = 0; quad < 7; quad++) {
+			int frame = FindSprite(quadNames[quad]);
+			if (frame >= 0) {
+				SkinQuad(quad, gSpriteFrames[frame]);
+			}
+		}
+
+		for (size_t i = 0; i < build->placements.size(); i++) {
+			SpriteDraw placement = build->placements[i];
+			placement.frame = FindSprite(build->placementNames[i]);
+			if (placement.frame >= 0) {
+				gSpriteDecorations.push_back(placement);
+			}
+		}
+	};
+
+	QueueAssetLoad(std::move(load));
+}
+
+//Sorts this frame's sprites and writes them after the world quads,
+//so Draw() still covers everything with one glDrawElements
+void UploadSprites(FrameVector<SpriteDraw>& sprites) {
+	gSpriteDrawCount = 0;
+
+	if (sprites.empty() || gVertexBufferObject == 0 || gSpriteAtlasTexture == 0) {
+		return;
+	}
+
+	//Back to front, then grouped by atlas page, submission order breaks ties
+	std::sort(sprites.begin(), sprites.end(), [](const SpriteDraw& a, const SpriteDraw& b) {
+		if (a.depth != b.depth) {
+			return a.depth < b.depth;
+		}
+		int layerA = gSpriteFrames[a.frame].layer;
+		int layerB = gSpriteFrames[b.frame].layer;
+		if (layerA != layerB) {
+			return layerA < layerB;
+		}
+		return a.order < b.order;
+	});
+
+	int count = std::min(static_cast<int>(sprites.size()), gMaxSprites);
+	FrameVector<GLfloat> positions(count * 4 * 6, 0.0f, FrameAllocator<GLfloat>(gFrameArena));
+	FrameVector<GLfloat> texCoords(count * 4 * 3, 0.0f, FrameAllocator<GLfloat>(gFrameArena));
+
+	for (int i = 0; i < count; i++) {
+		const SpriteDraw& sprite = sprites[i];
+		const SpriteFrame& frame = gSpriteFrames[sprite.frame];
+
+		//Same corner order as the world quads: bottom left, bottom right, top left, top right
+		GLfloat corners[4][4] = {
+			{ sprite.position.x,                 sprite.position.y,                 frame.u0, frame.v0 },
+			{ sprite.position.x + sprite.size.x, sprite.position.y,                 frame.u1, frame.v0 },
+			{ sprite.position.x,                 sprite.position.y + sprite.size.y, frame.u0, frame.v1 },
+			{ sprite.position.x + sprite.size.x, sprite.position.y + sprite.size.y, frame.u1, frame.v1 }
+		};
+
+		for (int vertex = 0; vertex < 4; vertex++) {
+			GLfloat* position = &positions[(i * 4 + vertex) * 6];
+			position[0] = corners[vertex][0];
+			position[1] = corners[vertex][1];
+			position[3] = 1.0f; //White, the texture supplies the color
+			position[4] = 1.0f;
+			position[5] = 1.0f;
+
+			GLfloat* texCoord = &texCoords[(i * 4 + vertex) * 3];
+			texCoord[0] = corners[vertex][2];
+			texCoord[1] = corners[vertex][3];
+			texCoord[2] = static_cast<float>(frame.layer);
+		}
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, gVertexBufferObject);
+	glBufferSubData(GL_ARRAY_BUFFER, gVertexFloatCount * sizeof(GLfloat), positions.size() * sizeof(GLfloat), positions.data());
+	glBindBuffer(GL_ARRAY_BUFFER, gTexCoordBufferObject);
+	glBufferSubData(GL_ARRAY_BUFFER, gQuadVertexCount * 3 * sizeof(GLfloat), texCoords.size() * sizeof(GLfloat), texCoords.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	gSpriteDrawCount = count;
+}
+
+//Dynamic resolution: the scene is drawn into an offscreen target at a
+//fraction of the window size, then stretched to the window in one blit.
+//The fraction follows a frame-time budget.
+void CreateSceneFramebuffer() {
+	//Sized for the full window, lower resolutions just use the bottom-left corner of it
+	glGenRenderbuffers(1, &gSceneColorRenderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, gSceneColorRenderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, gScreenWidth, gScreenHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &gSceneFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, gSceneFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, gSceneColorRenderbuffer);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cout << "Scene framebuffer is incomplete" << std::endl;
+		exit(1);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenQueries(gFrameTimeQueryCount, gFrameTimeQueries);
+
+	gRenderStats.renderWidth = gScreenWidth;
+	gRenderStats.renderHeight = gScreenHeight;
+}
+
+//Stretches the scene to the window
+void PresentScene() {
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, gSceneFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, gRenderStats.renderWidth, gRenderStats.renderHeight,
+		0, 0, gScreenWidth, gScreenHeight,
+		GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (gFrameTimeQueryActive) {
+		glEndQuery(GL_TIME_ELAPSED);
+		gFrameTimeQueryPending[gFrameTimeQueryIndex] = true;
+		gFrameTimeQueryIndex = (gFrameTimeQueryIndex + 1) % gFrameTimeQueryCount;
+		gFrameTimeQueryActive = false;
+	}
+}
+
+//Starts timing the frame, unless every slot is still waiting on the GPU
+void BeginFrameTiming() {
+	if (gFrameTimeQueryPending[gFrameTimeQueryIndex]) {
+		gFrameTimeQueryActive = false;
+		return;
+	}
+
+	glBeginQuery(GL_TIME_ELAPSED, gFrameTimeQueries[gFrameTimeQueryIndex]);
+	gFrameTimeQueryActive = true;
+}
+
+//Hysteresis: drop quickly when over budget, climb back slowly and only with headroom
+void AddFrameTimeSample(float frameTimeMs) {
+	gRenderStats.gpuFrameTimeMs = frameTimeMs;
+
+	if (frameTimeMs > gFrameTimeBudgetMs) {
+		gFramesOverBudget++;
+		gFramesUnderBudget = 0;
+	}
+	else if (frameTimeMs < gFrameTimeBudgetMs * gScaleUpHeadroom) {
+		gFramesUnderBudget++;
+		gFramesOverBudget = 0;
+	}
+	else {
+		gFramesOverBudget = 0;
+		gFramesUnderBudget = 0;
+	}
+}
+
+void UpdateResolutionScale(float cpuFrameTimeMs) {
+	gRenderStats.cpuFrameTimeMs = cpuFrameTimeMs;
+
+	//Read finished queries oldest first, stopping at the first one the GPU hasn't reached so we never stall
+	for (int i = 0; i < gFrameTimeQueryCount; i++) {
+		int slot = (gFrameTimeQueryIndex + i) % gFrameTimeQueryCount;
+		if (!gFrameTimeQueryPending[slot]) {
+			continue;
+		}
+
+		GLint available = 0;
+		glGetQueryObjectiv(gFrameTimeQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			break;
+		}
+
+		GLuint64 elapsedNs = 0;
+		glGetQueryObjectui64v(gFrameTimeQueries[slot], GL_QUERY_RESULT, &elapsedNs);
+		gFrameTimeQueryPending[slot] = false;
+		AddFrameTimeSample(static_cast<float>(elapsedNs) / 1000000.0f);
+	}
+
+	float scale = gRenderStats.resolutionScale;
+	if (gFramesOverBudget >= gScaleDownFrames) {
+		scale = std::max(gMinResolutionScale, scale - gResolutionScaleStep);
+		gFramesOverBudget = 0;
+	}
+	else if (gFramesUnderBudget >= gScaleUpFrames) {
+		scale = std::min(gMaxResolutionScale, scale + gResolutionScaleStep);
+		gFramesUnderBudget = 0;
+	}
+
+	gRenderStats.resolutionScale = scale;
+	gRenderStats.renderWidth = std::max(1, static_cast<int>(gScreenWidth * scale));
+	gRenderStats.renderHeight = std::max(1, static_cast<int>(gScreenHeight * scale));
+
+	//Show the stats in the title bar a couple of times a second
+	Uint32 now = SDL_GetTicks();
+	if (now - gLastStatsTitleTime >= 500) {
+		char title[128];
+		std::snprintf(title, sizeof(title), "%s | %d%% (%dx%d) | GPU %.2f ms | CPU %.2f ms",
+			gWindowTitle, static_cast<int>(scale * 100.0f + 0.5f),
+			gRenderStats.renderWidth, gRenderStats.renderHeight,
+			gRenderStats.gpuFrameTimeMs, gRenderStats.cpuFrameTimeMs);
+		SDL_SetWindowTitle(gGraphicsApplicationWindow, title);
+		gLastStatsTitleTime = now;
+	}
+}
+
+void PreDraw(const std::vector<GLfloat>& vertexData) {
+	//Upload the split geometry once, however many ticks changed it
+	if (gVertexDataDirty && gVertexBufferObject != 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, gVertexBufferObject);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, vertexData.size() * sizeof(GLfloat), vertexData.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		gVertexDataDirty = false;
+	}
+
+	//Same for texture coordinates once the atlas has skinned some quads
+	if (gTexCoordsDirty && gTexCoordBufferObject != 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, gTexCoordBufferObject);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(gQuadTexCoords), gQuadTexCoords);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		gTexCoordsDirty = false;
+	}
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+
+	//Draw into the part of the scene target that matches the current scale
+	glBindFramebuffer(GL_FRAMEBUFFER, gSceneFramebuffer);
+	glViewport(0, 0, gRenderStats.renderWidth, gRenderStats.renderHeight);
+	glClearColor(1.f, 1.f, 0.f, 1.f);
+
+	//Only clear what we draw into, fill rate is the cost we are trying to save
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(0, 0, gRenderStats.renderWidth, gRenderStats.renderHeight);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
+
+	//Until the loader is done the cleared frame is the placeholder
+	if (!SceneAssetsReady()) {
+		return;
+	}
+
+	glUseProgram(gGraphicsPipelineShaderProgram);
+	
+	
+
+	glm::mat4 translate5 = glm::translate(glm::mat4(1.0f), glm::vec3(g_uOffsetQuad5, g_vOffsetQuad5, 0.0f));
+	glm::mat4 translate = glm::translate(glm::mat4(1.0f), glm::vec3(g_uOffsetQuad1, g_vOffsetQuad1, 0.0f));
+	glm::mat4 translate6 = glm::translate(glm::mat4(1.0f), glm::vec3(g_uOffsetQuad6, g_vOffsetQuad6, 0.0f));
+	glm::mat4 translate7 = glm::translate(glm::mat4(1.0f), glm::vec3(g_uOffsetQuad7, g_vOffsetQuad7, 0.0f));
+
+	//Retrieve our location of our Model Matrix
+	GLint u_ModelMatrixLocation = glGetUniformLocation(gGraphicsPipelineShaderProgram, "u_ModelMatrix");
+	GLint u_ModelMatrixLocation2 = glGetUniformLocation(gGraphicsPipelineShaderProgram, "u_ModelMatrix2");
+	GLint u_ModelMatrixLocation3 = glGetUniformLocation(gGraphicsPipelineShaderProgram, "u_ModelMatrix3");
+	GLuint u_ModelMatrixLocation4 = glGetUniformLocation(gGraphicsPipelineShaderProgram, "u_ModelMatrix4");
+	GLuint u_ModelMatrixLocation5 = glGetUniformLocation(gGraphicsPipelineShaderProgram, "u_ModelMatrix5");
+
+	if (u_ModelMatrixLocation >= 0) {
+		glUniformMatrix4fv(u_ModelMatrixLocation, 1, GL_FALSE, &translate[0][0]);
+	}
+	else {
+		std::cout << "Could not find u_ModelMatrix. \n";
+		exit(EXIT_FAILURE);
 	}
 
 	// Pass the second model matrix to the shader program
@@ -738,36 +2788,124 @@ void PreDraw() {
 
 void Draw() {
 
+	if (!SceneAssetsReady()) {
+		return;
+	}
+
 	glBindVertexArray(gVertexArrayObject);
 	glBindBuffer(GL_ARRAY_BUFFER, gVertexBufferObject);
 
+	//Every page is a layer of the same texture, so one bind covers all sprites
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, gSpriteAtlasTexture);
+
+	//World quads and sprites together
 	glDrawElements(GL_TRIANGLES,
-		42, //Total number of indicies
+		42 + gSpriteDrawCount * 6, //Total number of indicies
 		GL_UNSIGNED_INT,
 		0);
 
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
 	glUseProgram(0);
 
 }
 
-void MainLoop(std::vector<GLfloat> vertexData) {
+void MainLoop(std::vector<GLfloat>& vertexData) {
+
+	Uint64 frameCount = 0;
+	bool sceneShown = false;
+	Uint64 lastFrameCounter = SDL_GetPerformanceCounter();
 
 	while (!gQuit) {
+		Uint64 frameStartCounter = SDL_GetPerformanceCounter();
+
+		//Anything allocated from the arena last frame is dead now
+		FrameArenaReset(gFrameArena);
+		Uint64 allocationsAtFrameStart = gHeapAllocationCount.load(std::memory_order_relaxed);
+		bool loadingAtFrameStart = AssetLoadsPending();
+
+		//Gameplay events for this frame, kept in the arena
+		FrameVector<GameEvent> frameEvents{ FrameAllocator<GameEvent>(gFrameArena) };
+		gFrameEvents = &frameEvents;
+
+		//Sprites for this frame, also in the arena
+		FrameVector<SpriteDraw> frameSprites{ FrameAllocator<SpriteDraw>(gFrameArena) };
+		gFrameSprites = &frameSprites;
+		for (const SpriteDraw& decoration : gSpriteDecorations) {
+			SubmitSprite(decoration.frame, decoration.position.x, decoration.position.y, decoration.size.x, decoration.size.y, decoration.depth);
+		}
+
+		PumpAssetLoads();
+
 		Input(vertexData);
 
-		PreDraw();
+		float deltaTime = std::min(0.05f, static_cast<float>(frameStartCounter - lastFrameCounter) / SDL_GetPerformanceFrequency());
+		lastFrameCounter = frameStartCounter;
+
+		//All of the frame's GPU work is timed, from the particle update until PresentScene() finishes the blit
+		BeginFrameTiming();
+
+		UpdateParticles(frameEvents, deltaTime);
+
+		UploadSprites(frameSprites);
+
+		PreDraw(vertexData);
 
 		Draw();
 
+		DrawParticles();
+
+		PresentScene();
+
 		//Update the screen
 		SDL_GL_SwapWindow(gGraphicsApplicationWindow);
 
+		if (frameCount == 0 || (!sceneShown && SceneAssetsReady())) {
+			float sinceStartupMs = static_cast<float>(SDL_GetPerformanceCounter() - gStartupCounter) * 1000.0f / SDL_GetPerformanceFrequency();
+			std::cout << (frameCount == 0 ? "First frame after " : "Assets ready after ") << sinceStartupMs << " ms" << std::endl;
+			sceneShown = SceneAssetsReady();
+		}
+
+		float cpuFrameTimeMs = static_cast<float>(SDL_GetPerformanceCounter() - frameStartCounter) * 1000.0f / SDL_GetPerformanceFrequency();
+		UpdateResolutionScale(cpuFrameTimeMs);
+
+		//Once warmed up a frame should never touch the global heap.
+		//Loader threads allocate while they work, so frames with loads in flight don't count.
+		Uint64 frameAllocations = gHeapAllocationCount.load(std::memory_order_relaxed) - allocationsAtFrameStart;
+		bool loading = loadingAtFrameStart || AssetLoadsPending();
+		if (frameCount >= gWarmupFrames && !loading && frameAllocations != 0) {
+#ifndef NDEBUG
+			if (gSteadyStateHeapAllocations == 0) {
+				std::cout << "Frame " << frameCount << " made " << frameAllocations << " heap allocation(s)" << std::endl;
+			}
+#endif
+			gSteadyStateHeapAllocations += frameAllocations;
+		}
+		gFrameEvents = nullptr;
+		gFrameSprites = nullptr;
+		frameCount++;
 	}
 
+	std::cout << "Frame arena high-water mark: " << gFrameArena.highWaterMark << " / " << gFrameArena.capacity << " bytes" << std::endl;
+	std::cout << "Heap allocations after warm-up: " << gSteadyStateHeapAllocations << std::endl;
+	std::cout << "Final resolution scale: " << gRenderStats.resolutionScale << " (GPU " << gRenderStats.gpuFrameTimeMs << " ms)" << std::endl;
+
 }
 
 void CleanUp() {
+	NetplayStop();
+	StopAssetLoader();
+
+	glDeleteQueries(gFrameTimeQueryCount, gFrameTimeQueries);
+	glDeleteFramebuffers(1, &gSceneFramebuffer);
+	glDeleteRenderbuffers(1, &gSceneColorRenderbuffer);
+	FrameArenaDestroy(gFrameArena);
+
 	//Make sure window isnt still allocated
+	if (gLoaderWindow != nullptr) {
+		SDL_DestroyWindow(gLoaderWindow);
+	}
 	SDL_DestroyWindow(gGraphicsApplicationWindow);
 	SDL_Quit();
 
@@ -775,16 +2913,44 @@ void CleanUp() {
 
 int main(int argc,char* args[])
 {
+	gStartupCounter = SDL_GetPerformanceCounter();
+
 	std::vector<GLfloat> vertexData;
 	//Sets up SDL window and OpenGL
 	InitializeProgram();
 
-	//Gets vertex data on to the GPU
+	//Worker threads for file reads, plus a GL upload thread if we got a shared context
+	StartAssetLoader(gLoaderWindow, gLoaderContext);
+
+	//Scratch memory for per-frame data, reset every MainLoop iteration
+	FrameArenaCreate(gFrameArena, gFrameArenaSize);
+
+	//Builds vertex data and queues it for upload to the GPU
 	VertexSpecification(vertexData);
 
-	//Creates pipline with vertex and fragment shader
+	//Netplay: Main --netplay <player 1|2> <localPort> <remoteIP> <remotePort> [latencyMs] [lossPercent]
+	if (argc >= 6 && std::strcmp(args[1], "--netplay") == 0) {
+		int player = std::atoi(args[2]) == 2 ? 1 : 0;
+		Uint32 latencyMs = argc >= 7 ? static_cast<Uint32>(std::atoi(args[6])) : 0;
+		int lossPercent = argc >= 8 ? std::atoi(args[7]) : 0;
+		NetplayStart(player, std::atoi(args[3]), args[4], std::atoi(args[5]), latencyMs, lossPercent);
+
+		gWindowTitle = player == 0 ? "Game Window - Player 1" : "Game Window - Player 2";
+		SDL_SetWindowTitle(gGraphicsApplicationWindow, gWindowTitle);
+	}
+
+	//Queues the pipline with vertex and fragment shader, compiled on the loader thread
 	CreateGraphicsPipeline();
 
+	//Offscreen target for dynamic resolution
+	CreateSceneFramebuffer();
+
+	//Transform feedback debris, loaded like everything else
+	CreateParticleSystem();
+
+	//Packs the images in sprites.txt into the atlas on a worker thread
+	CreateSpriteAtlas();
+
 	//Handles input, PreDraw, and Draw. Updates every frame
 	MainLoop(vertexData);
 
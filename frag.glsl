@@ -1,6 +1,9 @@
 #version 410 core
 
 in vec3 v_vertexColors;
+in vec3 v_texCoords;
+
+uniform sampler2DArray u_SpriteAtlas;
 
 out vec4 color;
 
@@ -8,5 +11,13 @@ out vec4 color;
 
 void main()
 {
-    color = vec4(v_vertexColors.r, v_vertexColors.g, v_vertexColors.b, 1.0f);
+    if (v_texCoords.z >= 0.0f) {
+        color = texture(u_SpriteAtlas, v_texCoords);
+        //Cut-out transparency, so the batch needs no blend state
+        if (color.a < 0.5f) {
+            discard;
+        }
+    } else {
+        color = vec4(v_vertexColors.r, v_vertexColors.g, v_vertexColors.b, 1.0f);
+    }
 };
\ No newline at end of file
@@ -0,0 +1,10 @@
+#version 410 core
+
+in vec4 v_particleColor;
+
+out vec4 color;
+
+void main()
+{
+    color = v_particleColor;
+}
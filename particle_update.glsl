@@ -0,0 +1,76 @@
+#version 410 core
+
+//Particle simulation, run with transform feedback and the rasterizer off.
+//Reads last frame's particle buffer and writes the next one.
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec2 velocity;
+layout(location = 2) in vec2 ageLife; //x = age, y = lifetime (seconds), dead once age >= lifetime
+
+out vec2 tf_position;
+out vec2 tf_velocity;
+out vec2 tf_ageLife;
+
+uniform float u_DeltaTime;
+uniform float u_Gravity;
+uniform float u_Floor;
+uniform uint u_Seed;
+uniform int u_ParticleCount;
+
+//Bursts started this frame. A burst respawns the particles in
+//[first, first + count), wrapping around the end of the buffer.
+const int MAX_BURSTS = 16;
+uniform int u_BurstCount;
+uniform ivec2 u_BurstRange[MAX_BURSTS];  //x = first particle, y = count
+uniform vec4 u_BurstShape[MAX_BURSTS];   //xy = origin, zw = half size of the spawn area
+uniform vec2 u_BurstMotion[MAX_BURSTS];  //x = speed, y = lifetime
+
+float Random(uint x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return float(x) / 4294967295.0;
+}
+
+void main()
+{
+	vec2 newPosition = position;
+	vec2 newVelocity = velocity;
+	vec2 newAgeLife = ageLife;
+	bool spawned = false;
+
+	for (int i = 0; i < u_BurstCount; i++) {
+		int offset = (gl_VertexID - u_BurstRange[i].x + u_ParticleCount) % u_ParticleCount;
+		if (offset < u_BurstRange[i].y) {
+			uint seed = uint(gl_VertexID) * 747796405u + u_Seed;
+			float angle = Random(seed) * 6.2831853;
+			float speed = u_BurstMotion[i].x * (0.25 + 0.75 * Random(seed + 1u));
+			vec2 jitter = vec2(Random(seed + 2u), Random(seed + 3u)) * 2.0 - 1.0;
+
+			newPosition = u_BurstShape[i].xy + jitter * u_BurstShape[i].zw;
+			newVelocity = vec2(cos(angle), sin(angle)) * speed;
+			newAgeLife = vec2(0.0, u_BurstMotion[i].y * (0.5 + 0.5 * Random(seed + 4u)));
+			spawned = true;
+		}
+	}
+
+	if (!spawned && newAgeLife.x < newAgeLife.y) {
+		newVelocity.y += u_Gravity * u_DeltaTime;
+		newPosition += newVelocity * u_DeltaTime;
+
+		//Bounce off the floor, losing most of the energy
+		if (newPosition.y < u_Floor && newVelocity.y < 0.0) {
+			newPosition.y = u_Floor;
+			newVelocity.y *= -0.3;
+			newVelocity.x *= 0.6;
+		}
+
+		newAgeLife.x += u_DeltaTime;
+	}
+
+	tf_position = newPosition;
+	tf_velocity = newVelocity;
+	tf_ageLife = newAgeLife;
+}
@@ -0,0 +1,25 @@
+#version 410 core
+
+layout(location = 0) in vec2 position;
+layout(location = 2) in vec2 ageLife;
+
+uniform float u_PointSize;
+
+out vec4 v_particleColor;
+
+void main()
+{
+	float life = ageLife.y > 0.0 ? ageLife.x / ageLife.y : 1.0;
+
+	//Dead particles are pushed outside the clip volume
+	if (life >= 1.0) {
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+		gl_PointSize = 1.0;
+		v_particleColor = vec4(0.0);
+		return;
+	}
+
+	gl_Position = vec4(position, 0.0, 1.0);
+	gl_PointSize = u_PointSize;
+	v_particleColor = vec4(mix(vec3(0.35, 0.2, 0.05), vec3(0.1, 0.1, 0.1), life), 1.0 - life);
+}
@@ -3,6 +3,7 @@
 //My diffrent attributes
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 vertexColors;
+layout(location = 2) in vec3 texCoords; //u, v, atlas layer (-1 = untextured)
 
 uniform mat4 u_ModelMatrix;
 uniform mat4 u_ModelMatrix2;
@@ -13,14 +14,18 @@ uniform mat4 u_ModelMatrix5;
 //uniform float u_offset; //Uniform variable
 
 out vec3 v_vertexColors;
+out vec3 v_texCoords;
 
 
 void main()
 {
 	v_vertexColors = vertexColors;
+	v_texCoords = texCoords;
 	//vec4 newPosition = u_ModelMatrix * vec4(position, 1.0f);
 
-	 if (gl_VertexID < 4) { // Assuming each quad has 6 vertices
+	 if (gl_VertexID >= 28) { // Sprites come after the 7 world quads, already in place
+		gl_Position = vec4(position, 1.0f);
+	} else if (gl_VertexID < 4) { // Assuming each quad has 6 vertices
         gl_Position = u_ModelMatrix * vec4(position, 1.0f);
     } else if (gl_VertexID >= 16 && gl_VertexID < 20){
 		gl_Position = u_ModelMatrix3 * vec4(position, 1.0f);